@@ -0,0 +1,72 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blit.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Copies bigger than this would only evict the rest of the cache on their
+ * way to a buffer we won't read again; the compositor reads it, not us.
+ */
+#define BLIT_STREAM_THRESHOLD (8 << 20)
+
+static void
+copy_row(uint32_t *dst, const uint32_t *src, size_t n, bool stream)
+{
+#if defined(__SSE2__)
+    if (stream) {
+        size_t i = 0;
+        for (; i < n && ((uintptr_t)&dst[i] & 15) != 0; ++i)
+            dst[i] = src[i];
+        for (; i + 4 <= n; i += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+            _mm_stream_si128((__m128i *)&dst[i], v);
+        }
+        for (; i < n; ++i)
+            dst[i] = src[i];
+        return;
+    }
+#endif
+    memmove(dst, src, n * sizeof(uint32_t));
+}
+
+void
+blit_scroll(uint32_t *dst, const uint32_t *src,
+        int width, int height, int stride, int dx, int dy,
+        struct damage *exposed)
+{
+    if (abs(dx) >= width || abs(dy) >= height) {
+        damage_add(exposed, 0, 0, width, height);
+        return;
+    }
+
+    int copy_w = width - abs(dx), copy_h = height - abs(dy);
+    /* Destination rectangle that has a source */
+    int x0 = dx < 0 ? -dx : 0, y0 = dy < 0 ? -dy : 0;
+    /* Non-temporal stores cannot be used in place: rows may overlap */
+    bool stream = dst != src
+        && (size_t)copy_w * copy_h * sizeof(uint32_t) >= BLIT_STREAM_THRESHOLD;
+
+    /* In place, walk away from the rows still to be read */
+    int first = dy >= 0 ? 0 : copy_h - 1;
+    int step = dy >= 0 ? 1 : -1;
+    for (int i = 0, y = y0 + first; i < copy_h; ++i, y += step) {
+        uint32_t *d = (uint32_t *)((char *)dst + (size_t)y * stride) + x0;
+        const uint32_t *s = (const uint32_t *)((const char *)src
+                + (size_t)(y + dy) * stride) + x0 + dx;
+        copy_row(d, s, copy_w, stream);
+    }
+#if defined(__SSE2__)
+    if (stream)
+        _mm_sfence();
+#endif
+
+    /* Full-width band above or below, then the column beside the copy */
+    damage_add(exposed, 0, dy < 0 ? 0 : copy_h, width, abs(dy));
+    damage_add(exposed, dx < 0 ? 0 : copy_w, y0, abs(dx), copy_h);
+}
@@ -0,0 +1,17 @@
+#ifndef BLIT_H
+#define BLIT_H
+
+#include <stdint.h>
+#include "damage.h"
+
+/*
+ * Copies src into dst so that dst(x, y) = src(x + dx, y + dy), i.e. the
+ * content scrolls by (-dx, -dy). src and dst may be the same buffer. The
+ * pixels with no source, which the caller must still draw, are added to
+ * exposed. stride is in bytes.
+ */
+void blit_scroll(uint32_t *dst, const uint32_t *src,
+        int width, int height, int stride, int dx, int dy,
+        struct damage *exposed);
+
+#endif
@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200112L
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "buffer_pool.h"
+#include "metrics.h"
+#include "shm.h"
+
+static void
+pool_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+    /* Sent by the compositor when it's no longer using this buffer */
+    struct pool_buffer *buffer = data;
+    if (buffer->wl_buffer != wl_buffer) {
+        /* Orphaned by a resize while the compositor still held it */
+        wl_buffer_destroy(wl_buffer);
+        --buffer->pool->orphans;
+        return;
+    }
+    buffer->busy = false;
+    metrics_count(buffer->pool->metrics, METRICS_BUFFER_RELEASES);
+}
+
+static const struct wl_buffer_listener pool_buffer_listener = {
+    .release = pool_buffer_release,
+};
+
+static void
+destroy_buffers(struct buffer_pool *pool)
+{
+    for (int i = 0; i < pool->nslots; ++i) {
+        struct pool_buffer *buffer = &pool->slots[i];
+        if (buffer->wl_buffer == NULL)
+            continue;
+        /* The release handler destroys it once it no longer matches */
+        if (buffer->busy)
+            ++pool->orphans;
+        else
+            wl_buffer_destroy(buffer->wl_buffer);
+        buffer->wl_buffer = NULL;
+        buffer->data = NULL;
+        buffer->frame = 0;
+        buffer->busy = false;
+    }
+}
+
+static void
+close_pool(struct buffer_pool *pool)
+{
+    if (pool->wl_shm_pool != NULL)
+        wl_shm_pool_destroy(pool->wl_shm_pool);
+    if (pool->data != NULL)
+        munmap(pool->data, pool->size);
+    if (pool->fd >= 0)
+        close(pool->fd);
+    pool->wl_shm_pool = NULL;
+    pool->data = NULL;
+    pool->size = 0;
+    pool->fd = -1;
+}
+
+static bool
+open_pool(struct buffer_pool *pool, size_t size, int flags)
+{
+    int fd = allocate_shm_file(size, flags);
+    if (fd < 0)
+        return false;
+    size = shm_file_size(fd);
+    if (size > INT32_MAX) {
+        close(fd);
+        return false;
+    }
+
+    /* Huge page reservations are taken here, not at allocation time */
+    void *data = mmap(NULL, size,
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    pool->fd = fd;
+    pool->data = data;
+    pool->size = size;
+    pool->wl_shm_pool = wl_shm_create_pool(pool->wl_shm, fd, size);
+    return true;
+}
+
+/*
+ * Starts over with a new file. Buffers created from the old wl_shm_pool
+ * stay valid after it is destroyed.
+ */
+static bool
+replace_pool(struct buffer_pool *pool, size_t size)
+{
+    close_pool(pool);
+    int flags = pool->shm_flags;
+    if (size < SHM_HUGEPAGE_THRESHOLD)
+        flags &= ~SHM_HUGEPAGES;
+    if (open_pool(pool, size, flags))
+        return true;
+    return (flags & SHM_HUGEPAGES)
+        && open_pool(pool, size, flags & ~SHM_HUGEPAGES);
+}
+
+static bool
+grow_pool(struct buffer_pool *pool, size_t size)
+{
+    if (size > INT32_MAX)
+        return false;
+
+    /* Extend the existing file in place if we can */
+    if (pool->fd >= 0 && resize_shm_file(pool->fd, size) == 0) {
+        size_t new_size = shm_file_size(pool->fd);
+        void *data = new_size <= INT32_MAX ? mmap(NULL, new_size,
+                PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0) : MAP_FAILED;
+        if (data != MAP_FAILED) {
+            munmap(pool->data, pool->size);
+            pool->data = data;
+            pool->size = new_size;
+            wl_shm_pool_resize(pool->wl_shm_pool, new_size);
+            return true;
+        }
+    }
+
+    return replace_pool(pool, size);
+}
+
+bool
+buffer_pool_resize(struct buffer_pool *pool, int width, int height)
+{
+    int stride = width * 4;
+    size_t slot_size = (size_t)stride * height;
+
+    destroy_buffers(pool);
+    pool->width = pool->height = pool->stride = 0;
+
+    /*
+     * Orphans still being read keep the old memory to themselves: new
+     * slots at the same offsets would be painted under the compositor.
+     */
+    size_t size = slot_size * pool->nslots;
+    if (pool->orphans > 0 && pool->data != NULL) {
+        if (!replace_pool(pool, size))
+            return false;
+    } else if (size > pool->size && !grow_pool(pool, size)) {
+        return false;
+    }
+
+    for (int i = 0; i < pool->nslots; ++i) {
+        struct pool_buffer *buffer = &pool->slots[i];
+        size_t offset = slot_size * i;
+        buffer->pool = pool;
+        buffer->data = (uint32_t *)((char *)pool->data + offset);
+        buffer->wl_buffer = wl_shm_pool_create_buffer(pool->wl_shm_pool,
+                offset, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffer->wl_buffer,
+                &pool_buffer_listener, buffer);
+    }
+
+    pool->width = width;
+    pool->height = height;
+    pool->stride = stride;
+    return true;
+}
+
+void
+buffer_pool_init(struct buffer_pool *pool, struct wl_shm *wl_shm,
+        int nslots, int shm_flags)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->wl_shm = wl_shm;
+    pool->fd = -1;
+    if (nslots > BUFFER_POOL_MAX_SLOTS)
+        nslots = BUFFER_POOL_MAX_SLOTS;
+    pool->nslots = nslots;
+    pool->shm_flags = shm_flags;
+}
+
+void
+buffer_pool_finish(struct buffer_pool *pool)
+{
+    destroy_buffers(pool);
+    close_pool(pool);
+}
+
+struct pool_buffer *
+buffer_pool_acquire(struct buffer_pool *pool, int width, int height)
+{
+    if ((width != pool->width || height != pool->height)
+            && !buffer_pool_resize(pool, width, height))
+        return NULL;
+
+    for (int i = 0; i < pool->nslots; ++i) {
+        struct pool_buffer *buffer = &pool->slots[i];
+        if (!buffer->busy) {
+            buffer->busy = true;
+            return buffer;
+        }
+    }
+    return NULL;
+}
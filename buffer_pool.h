@@ -0,0 +1,65 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+#define BUFFER_POOL_MAX_SLOTS 16
+
+struct buffer_pool;
+struct metrics;
+
+struct pool_buffer {
+    struct buffer_pool *pool;
+    struct wl_buffer *wl_buffer;
+    uint32_t *data;
+    /* damage_history frame the contents are from, 0 if never painted */
+    uint64_t frame;
+    /* Set while the compositor holds the buffer, cleared on wl_buffer.release */
+    bool busy;
+};
+
+/*
+ * One long-lived wl_shm_pool carved into nslots equally sized wl_buffers.
+ * The backing file and mapping are only reallocated when the surface grows
+ * past the current pool size, so steady-state frames make no syscalls.
+ */
+struct buffer_pool {
+    struct wl_shm *wl_shm;
+    struct wl_shm_pool *wl_shm_pool;
+    int fd;
+    int shm_flags;
+    void *data;
+    size_t size;
+
+    int width, height, stride;
+    int nslots;
+    struct pool_buffer slots[BUFFER_POOL_MAX_SLOTS];
+    /* Buffers from before a resize the compositor has yet to release */
+    int orphans;
+    /* Counts wl_buffer.release events if set */
+    struct metrics *metrics;
+};
+
+/* shm_flags are passed to allocate_shm_file(), see shm.h */
+void buffer_pool_init(struct buffer_pool *pool, struct wl_shm *wl_shm,
+        int nslots, int shm_flags);
+void buffer_pool_finish(struct buffer_pool *pool);
+
+/*
+ * Recreates every slot at the new size, growing the pool if needed. Slots
+ * the compositor still holds are destroyed once it releases them, and
+ * until then the new slots are placed in a fresh pool.
+ */
+bool buffer_pool_resize(struct buffer_pool *pool, int width, int height);
+
+/*
+ * Returns a free buffer of the requested size and marks it busy, or NULL if
+ * every slot is still held by the compositor (or allocation failed).
+ */
+struct pool_buffer *buffer_pool_acquire(struct buffer_pool *pool,
+        int width, int height);
+
+#endif
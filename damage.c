@@ -0,0 +1,147 @@
+#include <stdint.h>
+#include <string.h>
+#include "damage.h"
+
+static int64_t
+rect_area(const struct damage_rect *r)
+{
+    return (int64_t)r->width * r->height;
+}
+
+static bool
+rect_contains(const struct damage_rect *a, const struct damage_rect *b)
+{
+    return b->x >= a->x && b->y >= a->y
+        && b->x + b->width <= a->x + a->width
+        && b->y + b->height <= a->y + a->height;
+}
+
+static struct damage_rect
+rect_union(const struct damage_rect *a, const struct damage_rect *b)
+{
+    int32_t x1 = a->x < b->x ? a->x : b->x;
+    int32_t y1 = a->y < b->y ? a->y : b->y;
+    int32_t ax2 = a->x + a->width, bx2 = b->x + b->width;
+    int32_t ay2 = a->y + a->height, by2 = b->y + b->height;
+    int32_t x2 = ax2 > bx2 ? ax2 : bx2;
+    int32_t y2 = ay2 > by2 ? ay2 : by2;
+    return (struct damage_rect){ x1, y1, x2 - x1, y2 - y1 };
+}
+
+/* Pixels the union would cover that neither rectangle does (approximately) */
+static int64_t
+merge_cost(const struct damage_rect *a, const struct damage_rect *b)
+{
+    struct damage_rect u = rect_union(a, b);
+    int64_t cost = rect_area(&u) - rect_area(a) - rect_area(b);
+    return cost > 0 ? cost : 0;
+}
+
+/*
+ * Merging is worth it when the union wastes little compared to the rects
+ * themselves: compositors pay per rectangle as well as per pixel.
+ */
+static bool
+should_merge(const struct damage_rect *a, const struct damage_rect *b)
+{
+    int64_t smaller = rect_area(a) < rect_area(b) ? rect_area(a) : rect_area(b);
+    return merge_cost(a, b) <= smaller / 2;
+}
+
+void
+damage_clear(struct damage *damage)
+{
+    damage->nrects = 0;
+}
+
+bool
+damage_empty(const struct damage *damage)
+{
+    return damage->nrects == 0;
+}
+
+void
+damage_add(struct damage *damage,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+
+    struct damage_rect r = { x, y, width, height };
+    for (int i = 0; i < damage->nrects; ++i) {
+        struct damage_rect *cur = &damage->rects[i];
+        if (rect_contains(cur, &r))
+            return;
+        if (rect_contains(&r, cur) || should_merge(cur, &r)) {
+            /* Absorb it and rescan, the grown rect may now reach others */
+            r = rect_union(cur, &r);
+            damage->rects[i] = damage->rects[--damage->nrects];
+            i = -1;
+        }
+    }
+
+    if (damage->nrects < DAMAGE_MAX_RECTS) {
+        damage->rects[damage->nrects++] = r;
+        return;
+    }
+
+    /* Full: fold into whichever rect grows the least */
+    int best = 0;
+    int64_t best_cost = INT64_MAX;
+    for (int i = 0; i < damage->nrects; ++i) {
+        int64_t cost = merge_cost(&damage->rects[i], &r);
+        if (cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+    r = rect_union(&damage->rects[best], &r);
+    damage->rects[best] = damage->rects[--damage->nrects];
+    damage_add(damage, r.x, r.y, r.width, r.height);
+}
+
+void
+damage_union(struct damage *damage, const struct damage *other)
+{
+    for (int i = 0; i < other->nrects; ++i) {
+        const struct damage_rect *r = &other->rects[i];
+        damage_add(damage, r->x, r->y, r->width, r->height);
+    }
+}
+
+void
+damage_emit(const struct damage *damage, struct wl_surface *wl_surface)
+{
+    for (int i = 0; i < damage->nrects; ++i) {
+        const struct damage_rect *r = &damage->rects[i];
+        wl_surface_damage_buffer(wl_surface, r->x, r->y, r->width, r->height);
+    }
+}
+
+void
+damage_history_reset(struct damage_history *history)
+{
+    memset(history, 0, sizeof(*history));
+}
+
+uint64_t
+damage_history_push(struct damage_history *history,
+        const struct damage *damage)
+{
+    history->frame++;
+    history->frames[history->frame % DAMAGE_HISTORY_LEN] = *damage;
+    return history->frame;
+}
+
+bool
+damage_history_since(const struct damage_history *history,
+        uint64_t since, struct damage *out)
+{
+    damage_clear(out);
+    if (since == 0 || since > history->frame
+            || history->frame - since >= DAMAGE_HISTORY_LEN)
+        return false;
+    for (uint64_t f = since + 1; f <= history->frame; ++f)
+        damage_union(out, &history->frames[f % DAMAGE_HISTORY_LEN]);
+    return true;
+}
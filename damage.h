@@ -0,0 +1,56 @@
+#ifndef DAMAGE_H
+#define DAMAGE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+/* Past this the region is coalesced rather than grown */
+#define DAMAGE_MAX_RECTS 8
+
+/* Frames of damage remembered for buffer age; must cover the pool depth */
+#define DAMAGE_HISTORY_LEN 8
+
+struct damage_rect {
+    int32_t x, y, width, height;
+};
+
+/* A small list of buffer-space rectangles, merged as they are added */
+struct damage {
+    int nrects;
+    struct damage_rect rects[DAMAGE_MAX_RECTS];
+};
+
+void damage_clear(struct damage *damage);
+bool damage_empty(const struct damage *damage);
+void damage_add(struct damage *damage,
+        int32_t x, int32_t y, int32_t width, int32_t height);
+void damage_union(struct damage *damage, const struct damage *other);
+
+/* One wl_surface.damage_buffer per rectangle, call before commit */
+void damage_emit(const struct damage *damage, struct wl_surface *wl_surface);
+
+/*
+ * Damage of the last DAMAGE_HISTORY_LEN frames, numbered from 1. A buffer
+ * that was last painted at frame N only needs what changed after N.
+ */
+struct damage_history {
+    uint64_t frame;
+    struct damage frames[DAMAGE_HISTORY_LEN];
+};
+
+void damage_history_reset(struct damage_history *history);
+
+/* Records this frame's damage and returns its frame number */
+uint64_t damage_history_push(struct damage_history *history,
+        const struct damage *damage);
+
+/*
+ * Fills out with everything damaged after frame `since`. Returns false when
+ * that is no longer known (since is 0 or too old) and the caller must
+ * repaint the whole buffer.
+ */
+bool damage_history_since(const struct damage_history *history,
+        uint64_t since, struct damage *out);
+
+#endif
@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "event_loop.h"
+
+#define MAX_EVENTS 32
+
+enum event_source_type {
+    EVENT_SOURCE_FD,
+    EVENT_SOURCE_TIMER,
+    EVENT_SOURCE_EVENTFD,
+};
+
+struct event_source {
+    struct event_loop *loop;
+    enum event_source_type type;
+    int fd;
+    event_source_func func;
+    void *data;
+    bool removed;
+    struct event_source *next_removed;
+};
+
+struct event_loop {
+    int epoll_fd;
+    /* Removed during dispatch, freed once it is over */
+    struct event_source *removed;
+    /* The Wayland socket has no source, epoll data.ptr is NULL for it */
+    int display_fd;
+    uint32_t display_events;
+};
+
+struct event_loop *
+event_loop_create(void)
+{
+    struct event_loop *loop = calloc(1, sizeof(*loop));
+    if (loop == NULL)
+        return NULL;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        free(loop);
+        return NULL;
+    }
+    loop->display_fd = -1;
+    return loop;
+}
+
+static void
+free_removed(struct event_loop *loop)
+{
+    while (loop->removed != NULL) {
+        struct event_source *source = loop->removed;
+        loop->removed = source->next_removed;
+        free(source);
+    }
+}
+
+void
+event_loop_destroy(struct event_loop *loop)
+{
+    if (loop == NULL)
+        return;
+    free_removed(loop);
+    close(loop->epoll_fd);
+    free(loop);
+}
+
+static struct event_source *
+add_source(struct event_loop *loop, enum event_source_type type, int fd,
+        uint32_t events, event_source_func func, void *data)
+{
+    struct event_source *source = calloc(1, sizeof(*source));
+    if (source == NULL)
+        return NULL;
+    source->loop = loop;
+    source->type = type;
+    source->fd = fd;
+    source->func = func;
+    source->data = data;
+
+    struct epoll_event ev = { .events = events, .data.ptr = source };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        free(source);
+        return NULL;
+    }
+    return source;
+}
+
+struct event_source *
+event_loop_add_fd(struct event_loop *loop, int fd,
+        uint32_t events, event_source_func func, void *data)
+{
+    return add_source(loop, EVENT_SOURCE_FD, fd, events, func, data);
+}
+
+int
+event_source_fd_update(struct event_source *source, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = source };
+    return epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &ev);
+}
+
+struct event_source *
+event_loop_add_timer(struct event_loop *loop,
+        event_source_func func, void *data)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0)
+        return NULL;
+    struct event_source *source = add_source(loop, EVENT_SOURCE_TIMER, fd,
+            EPOLLIN, func, data);
+    if (source == NULL)
+        close(fd);
+    return source;
+}
+
+int
+event_source_timer_update(struct event_source *source,
+        uint64_t delay_ns, uint64_t interval_ns)
+{
+    struct itimerspec its = {
+        .it_value = {
+            .tv_sec = delay_ns / 1000000000,
+            .tv_nsec = delay_ns % 1000000000,
+        },
+        .it_interval = {
+            .tv_sec = interval_ns / 1000000000,
+            .tv_nsec = interval_ns % 1000000000,
+        },
+    };
+    return timerfd_settime(source->fd, 0, &its, NULL);
+}
+
+struct event_source *
+event_loop_add_eventfd(struct event_loop *loop,
+        event_source_func func, void *data)
+{
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0)
+        return NULL;
+    struct event_source *source = add_source(loop, EVENT_SOURCE_EVENTFD, fd,
+            EPOLLIN, func, data);
+    if (source == NULL)
+        close(fd);
+    return source;
+}
+
+int
+event_source_signal(struct event_source *source)
+{
+    uint64_t one = 1;
+    return write(source->fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
+
+void
+event_source_remove(struct event_source *source)
+{
+    if (source == NULL || source->removed)
+        return;
+    struct event_loop *loop = source->loop;
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    if (source->type != EVENT_SOURCE_FD)
+        close(source->fd);
+    source->removed = true;
+    source->next_removed = loop->removed;
+    loop->removed = source;
+}
+
+static void
+dispatch_source(struct event_source *source, uint32_t events)
+{
+    uint64_t value = events;
+    if (source->type != EVENT_SOURCE_FD) {
+        /* Both timerfd and eventfd hand us a counter and reset it */
+        if (read(source->fd, &value, sizeof(value)) != sizeof(value))
+            return;
+    }
+    source->func(source->data, value);
+}
+
+static int
+watch_display(struct event_loop *loop, int fd, uint32_t events)
+{
+    struct epoll_event ev = { .events = events, .data.ptr = NULL };
+    int op = loop->display_fd < 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (loop->display_fd >= 0 && loop->display_events == events)
+        return 0;
+    if (epoll_ctl(loop->epoll_fd, op, fd, &ev) < 0)
+        return -1;
+    loop->display_fd = fd;
+    loop->display_events = events;
+    return 0;
+}
+
+int
+event_loop_dispatch(struct event_loop *loop, struct wl_display *display,
+        int timeout)
+{
+    int display_fd = wl_display_get_fd(display);
+
+    /* Events already queued must be handled before we may block */
+    while (wl_display_prepare_read(display) != 0) {
+        if (wl_display_dispatch_pending(display) < 0)
+            return -1;
+    }
+
+    /* Whatever doesn't fit in the socket now is sent once it drains */
+    uint32_t display_events = EPOLLIN;
+    if (wl_display_flush(display) < 0) {
+        if (errno != EAGAIN) {
+            wl_display_cancel_read(display);
+            return -1;
+        }
+        display_events |= EPOLLOUT;
+    }
+    if (watch_display(loop, display_fd, display_events) < 0) {
+        wl_display_cancel_read(display);
+        return -1;
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int n;
+    do {
+        n = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        wl_display_cancel_read(display);
+        return -1;
+    }
+
+    uint32_t display_ready = 0;
+    for (int i = 0; i < n; ++i) {
+        if (events[i].data.ptr == NULL)
+            display_ready = events[i].events;
+    }
+
+    if (display_ready & (EPOLLERR | EPOLLHUP)) {
+        wl_display_cancel_read(display);
+        return -1;
+    }
+    if (display_ready & EPOLLIN) {
+        if (wl_display_read_events(display) < 0)
+            return -1;
+    } else {
+        wl_display_cancel_read(display);
+    }
+    if (wl_display_dispatch_pending(display) < 0)
+        return -1;
+
+    /* Wayland is consistent again, other sources may use it freely */
+    for (int i = 0; i < n; ++i) {
+        struct event_source *source = events[i].data.ptr;
+        if (source != NULL && !source->removed)
+            dispatch_source(source, events[i].events);
+    }
+    free_removed(loop);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+/*
+ * value is the epoll event mask for fd sources, the number of expirations
+ * for timers and the accumulated count for eventfd sources.
+ */
+typedef void (*event_source_func)(void *data, uint64_t value);
+
+struct event_loop;
+struct event_source;
+
+struct event_loop *event_loop_create(void);
+void event_loop_destroy(struct event_loop *loop);
+
+/* events is an EPOLLIN/EPOLLOUT mask; the fd stays owned by the caller */
+struct event_source *event_loop_add_fd(struct event_loop *loop, int fd,
+        uint32_t events, event_source_func func, void *data);
+int event_source_fd_update(struct event_source *source, uint32_t events);
+
+/* A CLOCK_MONOTONIC timerfd, disarmed until event_source_timer_update() */
+struct event_source *event_loop_add_timer(struct event_loop *loop,
+        event_source_func func, void *data);
+/* Fires after delay_ns, then every interval_ns if non-zero; 0, 0 disarms */
+int event_source_timer_update(struct event_source *source,
+        uint64_t delay_ns, uint64_t interval_ns);
+
+/* An eventfd other threads can wake the loop with */
+struct event_source *event_loop_add_eventfd(struct event_loop *loop,
+        event_source_func func, void *data);
+/* Safe to call from any thread */
+int event_source_signal(struct event_source *source);
+
+/* The source is freed once the current dispatch is over */
+void event_source_remove(struct event_source *source);
+
+/*
+ * Flushes and reads the Wayland connection and runs every other source
+ * that is ready, waiting at most timeout ms (-1 for no limit). When the
+ * socket buffer is full the rest of the flush waits for EPOLLOUT instead
+ * of blocking. Returns -1 on a fatal connection error.
+ */
+int event_loop_dispatch(struct event_loop *loop, struct wl_display *display,
+        int timeout);
+
+#endif
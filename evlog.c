@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "evlog.h"
+
+#define RING_SIZE \
+    (EVLOG_HEADER_SIZE + (size_t)EVLOG_RING_RECORDS * sizeof(struct evlog_record))
+
+_Static_assert(sizeof(struct evlog_header) <= EVLOG_HEADER_SIZE,
+        "header overlaps the records");
+_Static_assert((EVLOG_RING_RECORDS & (EVLOG_RING_RECORDS - 1)) == 0,
+        "ring size must be a power of two");
+
+/* Only the owning thread writes its ring, so no record is ever contended */
+static _Thread_local struct evlog_header *ring;
+static _Thread_local struct evlog_record *records;
+static _Thread_local bool ring_failed;
+
+static struct evlog_header *
+open_ring(void)
+{
+    /* Nothing cleans the files up, so only write them when asked to */
+    const char *dir = getenv("WL_EVLOG_DIR");
+    if (dir == NULL) {
+        return NULL;
+    }
+
+    pid_t tid = gettid();
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/" EVLOG_FILE_PREFIX "%d-%d.bin",
+            dir, (int)getpid(), (int)tid);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (ftruncate(fd, RING_SIZE) < 0) {
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+    struct evlog_header *header = mmap(NULL, RING_SIZE,
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (header == MAP_FAILED) {
+        unlink(path);
+        return NULL;
+    }
+
+    header->magic = EVLOG_MAGIC;
+    header->version = EVLOG_VERSION;
+    header->record_size = sizeof(struct evlog_record);
+    header->capacity = EVLOG_RING_RECORDS;
+    header->tid = tid;
+    header->head = 0;
+    return header;
+}
+
+void
+evlog_write(int level, enum evlog_type type, uint32_t time,
+        const union evlog_arg *arg)
+{
+    if (ring == NULL) {
+        if (ring_failed) {
+            return;
+        }
+        ring = open_ring();
+        if (ring == NULL) {
+            ring_failed = true;
+            return;
+        }
+        records = (struct evlog_record *)((char *)ring + EVLOG_HEADER_SIZE);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    uint64_t head = ring->head;
+    struct evlog_record *record = &records[head & (EVLOG_RING_RECORDS - 1)];
+    record->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    record->time = time;
+    record->type = type;
+    record->level = level;
+    record->arg = *arg;
+    /* A reader that sees head also sees the record behind it */
+    atomic_store_explicit((_Atomic uint64_t *)&ring->head, head + 1,
+            memory_order_release);
+}
+
+void
+evlog_thread_finish(void)
+{
+    if (ring != NULL) {
+        munmap(ring, RING_SIZE);
+    }
+    ring = NULL;
+    records = NULL;
+    ring_failed = false;
+}
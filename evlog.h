@@ -0,0 +1,130 @@
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <stdint.h>
+
+/*
+ * Binary event log. Each thread appends fixed-size records to its own
+ * mmap'd ring file, so logging takes no lock and makes no syscall after
+ * the first record. evlog_decode turns the files back into text. Rings
+ * are only created when WL_EVLOG_DIR is set; otherwise a record costs a
+ * thread-local check.
+ *
+ * Records below EVLOG_MIN_LEVEL are compiled out: build with
+ * -DEVLOG_MIN_LEVEL=EVLOG_NONE to remove logging altogether.
+ */
+
+#define EVLOG_DEBUG 0
+#define EVLOG_INFO 1
+#define EVLOG_WARN 2
+#define EVLOG_ERROR 3
+#define EVLOG_NONE 4
+
+#ifndef EVLOG_MIN_LEVEL
+#define EVLOG_MIN_LEVEL EVLOG_DEBUG
+#endif
+
+#define EVLOG_ENABLED(level) ((level) >= EVLOG_MIN_LEVEL)
+
+#define EVLOG_MAGIC 0x474f4c45 /* "ELOG" */
+#define EVLOG_VERSION 2
+/* Records per thread, a power of two: 2 MiB of log each */
+#define EVLOG_RING_RECORDS (1 << 16)
+
+/* Written next to each other in $WL_EVLOG_DIR, and only if it is set */
+#define EVLOG_FILE_PREFIX "wl-evlog-"
+
+enum evlog_type {
+    EVLOG_SEAT_NAME,            /* s: name, truncated */
+    EVLOG_SEAT_CAPABILITIES,    /* u[0]: capabilities */
+
+    EVLOG_POINTER_ENTER,        /* u[0]: serial, i[1], i[2]: fixed x, y */
+    EVLOG_POINTER_LEAVE,        /* u[0]: serial */
+    EVLOG_POINTER_MOTION,       /* i[0], i[1]: fixed x, y */
+    EVLOG_POINTER_BUTTON,       /* u[0]: serial, u[1]: button, u[2]: state */
+    EVLOG_POINTER_AXIS,         /* u[0]: axis, i[1]: fixed value */
+    EVLOG_POINTER_AXIS_SOURCE,  /* u[0]: source */
+    EVLOG_POINTER_AXIS_STOP,    /* u[0]: axis */
+    EVLOG_POINTER_AXIS_DISCRETE,/* u[0]: axis, i[1]: discrete */
+    EVLOG_POINTER_FRAME,
+    EVLOG_TOPLEVEL_MOVE,        /* u[0]: serial */
+
+    EVLOG_TOUCH_DOWN,           /* u[0]: serial, i[1]: id, i[2], i[3]: x, y */
+    EVLOG_TOUCH_UP,             /* u[0]: serial, i[1]: id */
+    EVLOG_TOUCH_MOTION,         /* i[1]: id, i[2], i[3]: fixed x, y */
+    EVLOG_TOUCH_CANCEL,
+    EVLOG_TOUCH_SHAPE,          /* i[1]: id, i[2], i[3]: fixed major, minor */
+    EVLOG_TOUCH_ORIENTATION,    /* i[1]: id, i[2]: fixed orientation */
+    EVLOG_TOUCH_FRAME,
+    EVLOG_GESTURE,              /* u[0]: type | phase << 8 | fingers << 16,
+                                 * i[1], i[2]: fixed dx, dy,
+                                 * i[3]: scale or radians in millionths */
+
+    EVLOG_KEYBOARD_ENTER,
+    EVLOG_KEYBOARD_ENTER_KEY,   /* key */
+    EVLOG_KEYBOARD_LEAVE,
+    EVLOG_KEY_PRESS,            /* key */
+    EVLOG_KEY_RELEASE,          /* key */
+    EVLOG_KEY_REPEAT,           /* key */
+
+    EVLOG_TYPE_COUNT,
+};
+
+union evlog_arg {
+    int32_t i[4];
+    uint32_t u[4];
+    char s[16];
+    struct {
+        /* evdev keycode, keysym and its UTF-8, truncated */
+        uint32_t code;
+        uint32_t sym;
+        char utf8[8];
+    } key;
+};
+
+struct evlog_record {
+    /* CLOCK_MONOTONIC when logged */
+    uint64_t ns;
+    /* The event's Wayland timestamp in ms, 0 if it has none */
+    uint32_t time;
+    uint16_t type;
+    uint16_t level;
+    union evlog_arg arg;
+};
+
+_Static_assert(sizeof(struct evlog_record) == 32, "two records per line");
+
+/* Start of every ring file, records follow at EVLOG_HEADER_SIZE */
+struct evlog_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;
+    uint32_t tid;
+    /* Records ever written, the newest capacity of them are kept */
+    uint64_t head;
+};
+
+#define EVLOG_HEADER_SIZE 64
+
+void evlog_write(int level, enum evlog_type type, uint32_t time,
+        const union evlog_arg *arg);
+
+/* Unmaps the calling thread's ring, the file stays for decoding */
+void evlog_thread_finish(void);
+
+#define evlog_raw(level, type, time, arg) do { \
+    if (EVLOG_ENABLED(level)) { \
+        evlog_write((level), (type), (time), (arg)); \
+    } \
+} while (0)
+
+/* Up to four 32-bit arguments, in union evlog_arg u[] order */
+#define evlog(level, type, time, ...) do { \
+    if (EVLOG_ENABLED(level)) { \
+        union evlog_arg evlog_arg_ = { .u = { __VA_ARGS__ } }; \
+        evlog_write((level), (type), (time), &evlog_arg_); \
+    } \
+} while (0)
+
+#endif
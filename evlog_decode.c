@@ -0,0 +1,479 @@
+/*
+ * Renders evlog ring files as the text the client used to print.
+ *
+ *     cc -o evlog_decode evlog_decode.c touch_table.c -lxkbcommon
+ *     evlog_decode [-t] $WL_EVLOG_DIR/wl-evlog-<pid>-*.bin
+ *
+ * Records from several threads are merged by timestamp. -t prefixes each
+ * event with its CLOCK_MONOTONIC time in seconds.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <xkbcommon/xkbcommon.h>
+#include "evlog.h"
+#include "gesture.h"
+#include "touch_table.h"
+
+/* Same accumulation as the client's wl_pointer and wl_touch handlers */
+enum pointer_event_mask {
+    POINTER_EVENT_ENTER = 1 << 0,
+    POINTER_EVENT_LEAVE = 1 << 1,
+    POINTER_EVENT_MOTION = 1 << 2,
+    POINTER_EVENT_BUTTON = 1 << 3,
+    POINTER_EVENT_AXIS = 1 << 4,
+    POINTER_EVENT_AXIS_SOURCE = 1 << 5,
+    POINTER_EVENT_AXIS_STOP = 1 << 6,
+    POINTER_EVENT_AXIS_DISCRETE = 1 << 7,
+};
+
+struct pointer_event {
+    uint32_t event_mask;
+    wl_fixed_t surface_x, surface_y;
+    uint32_t button, state;
+    uint32_t time;
+    struct {
+        bool valid;
+        wl_fixed_t value;
+        int32_t discrete;
+    } axes[2];
+    uint32_t axis_source;
+};
+
+struct touch_event {
+    uint32_t time;
+    struct touch_table points;
+};
+
+struct ring {
+    const struct evlog_header *header;
+    const struct evlog_record *records;
+    size_t size;
+    uint64_t next, end;
+};
+
+static struct pointer_event pointer_event;
+static struct touch_event touch_event;
+
+static bool
+ring_open(struct ring *ring, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < EVLOG_HEADER_SIZE) {
+        fprintf(stderr, "%s: not an event log\n", path);
+        close(fd);
+        return false;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+
+    const struct evlog_header *header = map;
+    size_t capacity = header->capacity;
+    if (header->magic != EVLOG_MAGIC || header->version != EVLOG_VERSION
+            || header->record_size != sizeof(struct evlog_record)
+            || capacity == 0 || (capacity & (capacity - 1)) != 0
+            || EVLOG_HEADER_SIZE + capacity * sizeof(struct evlog_record)
+                    > (size_t)st.st_size) {
+        fprintf(stderr, "%s: not an event log\n", path);
+        munmap(map, st.st_size);
+        return false;
+    }
+
+    ring->header = header;
+    ring->records = (const void *)((const char *)map + EVLOG_HEADER_SIZE);
+    ring->size = st.st_size;
+    ring->end = header->head;
+    /* Older records have been overwritten */
+    ring->next = ring->end > capacity ? ring->end - capacity : 0;
+    return true;
+}
+
+static const struct evlog_record *
+ring_peek(const struct ring *ring)
+{
+    if (ring->next == ring->end) {
+        return NULL;
+    }
+    return &ring->records[ring->next & (ring->header->capacity - 1)];
+}
+
+static void
+print_pointer_frame(void)
+{
+    struct pointer_event *event = &pointer_event;
+    printf("pointer frame @ %d: ", event->time);
+
+    if (event->event_mask & POINTER_EVENT_ENTER) {
+        printf("entered %f, %f ",
+                wl_fixed_to_double(event->surface_x),
+                wl_fixed_to_double(event->surface_y));
+    }
+
+    if (event->event_mask & POINTER_EVENT_LEAVE) {
+        printf("leave");
+    }
+
+    if (event->event_mask & POINTER_EVENT_MOTION) {
+        printf("motion %f, %f ",
+                wl_fixed_to_double(event->surface_x),
+                wl_fixed_to_double(event->surface_y));
+    }
+
+    if (event->event_mask & POINTER_EVENT_BUTTON) {
+        const char *state = event->state == WL_POINTER_BUTTON_STATE_RELEASED ?
+            "released" : "pressed";
+        printf("button %d %s ", event->button, state);
+    }
+
+    uint32_t axis_events = POINTER_EVENT_AXIS
+        | POINTER_EVENT_AXIS_SOURCE
+        | POINTER_EVENT_AXIS_STOP
+        | POINTER_EVENT_AXIS_DISCRETE;
+    const char *axis_name[2] = {
+        [WL_POINTER_AXIS_VERTICAL_SCROLL] = "vertical",
+        [WL_POINTER_AXIS_HORIZONTAL_SCROLL] = "horizontal",
+    };
+    const char *axis_source[4] = {
+        [WL_POINTER_AXIS_SOURCE_WHEEL] = "wheel",
+        [WL_POINTER_AXIS_SOURCE_FINGER] = "finger",
+        [WL_POINTER_AXIS_SOURCE_CONTINUOUS] = "continuous",
+        [WL_POINTER_AXIS_SOURCE_WHEEL_TILT] = "wheel tilt",
+    };
+    if (event->event_mask & axis_events) {
+        for (size_t i = 0; i < 2; ++i) {
+            if (!event->axes[i].valid) {
+                continue;
+            }
+            printf("%s axis ", axis_name[i]);
+            if (event->event_mask & POINTER_EVENT_AXIS) {
+                printf("value %f ", wl_fixed_to_double(event->axes[i].value));
+            }
+            if (event->event_mask & POINTER_EVENT_AXIS_DISCRETE) {
+                printf("discrete %d ", event->axes[i].discrete);
+            }
+            if (event->event_mask & POINTER_EVENT_AXIS_SOURCE) {
+                printf("via %s ", event->axis_source < 4 ?
+                        axis_source[event->axis_source] : "unknown");
+            }
+            if (event->event_mask & POINTER_EVENT_AXIS_STOP) {
+                printf("(stopped) ");
+            }
+        }
+    }
+
+    printf("\n");
+    memset(event, 0, sizeof(*event));
+}
+
+static void
+print_touch_frame(void)
+{
+    struct touch_table *points = &touch_event.points;
+    printf("touch event @ %d:\n", touch_event.time);
+
+    for (uint32_t i = 0; i < points->count; ++i) {
+        uint32_t mask = points->event_mask[i];
+        if (mask == 0) {
+            continue;
+        }
+        printf("point %d: ", points->id[i]);
+
+        if (mask & TOUCH_EVENT_DOWN) {
+            printf("down %f,%f ",
+                    wl_fixed_to_double(points->x[i]),
+                    wl_fixed_to_double(points->y[i]));
+        }
+
+        if (mask & TOUCH_EVENT_UP) {
+            printf("up ");
+        }
+
+        if (mask & TOUCH_EVENT_MOTION) {
+            printf("motion %f,%f ",
+                    wl_fixed_to_double(points->x[i]),
+                    wl_fixed_to_double(points->y[i]));
+        }
+
+        if (mask & TOUCH_EVENT_SHAPE) {
+            printf("shape %fx%f ",
+                    wl_fixed_to_double(points->major[i]),
+                    wl_fixed_to_double(points->minor[i]));
+        }
+
+        if (mask & TOUCH_EVENT_ORIENTATION) {
+            printf("orientation %f ",
+                    wl_fixed_to_double(points->orientation[i]));
+        }
+
+        printf("\n");
+    }
+    touch_table_end_frame(points);
+}
+
+static void
+print_gesture(const struct evlog_record *record)
+{
+    static const char *const types[] = {
+        [GESTURE_TAP] = "tap",
+        [GESTURE_PAN] = "pan",
+        [GESTURE_PINCH] = "pinch",
+        [GESTURE_ROTATE] = "rotate",
+    };
+    static const char *const phases[] = {
+        [GESTURE_BEGIN] = "begin",
+        [GESTURE_UPDATE] = "update",
+        [GESTURE_END] = "end",
+        [GESTURE_CANCEL] = "cancel",
+    };
+    const union evlog_arg *arg = &record->arg;
+    uint32_t type = arg->u[0] & 0xff, phase = arg->u[0] >> 8 & 0xff;
+    if (type >= GESTURE_TYPE_COUNT || phase > GESTURE_CANCEL) {
+        printf("gesture %u/%u\n", type, phase);
+        return;
+    }
+    printf("gesture @ %d: %s %s, %u fingers", record->time, types[type],
+            phases[phase], arg->u[0] >> 16);
+    switch (type) {
+    case GESTURE_PAN:
+        printf(" by %f,%f", wl_fixed_to_double(arg->i[1]),
+                wl_fixed_to_double(arg->i[2]));
+        break;
+    case GESTURE_PINCH:
+        printf(" by %f", arg->i[3] / 1e6);
+        break;
+    case GESTURE_ROTATE:
+        printf(" by %f rad", arg->i[3] / 1e6);
+        break;
+    }
+    printf("\n");
+}
+
+static void
+print_key(const char *prefix, const union evlog_arg *arg)
+{
+    char name[64];
+    xkb_keysym_get_name(arg->key.sym, name, sizeof(name));
+    printf("%ssym: %-12s (%d), utf8: '%.*s'\n", prefix, name,
+            (int)arg->key.sym, (int)sizeof(arg->key.utf8), arg->key.utf8);
+}
+
+static void
+print_record(const struct evlog_record *record)
+{
+    const union evlog_arg *arg = &record->arg;
+    struct pointer_event *pointer = &pointer_event;
+    struct touch_table *points = &touch_event.points;
+    int i;
+    uint32_t axis = arg->u[0] & 1;
+
+    switch (record->type) {
+    case EVLOG_SEAT_NAME:
+        printf("seat name: %.*s\n", (int)sizeof(arg->s), arg->s);
+        break;
+    case EVLOG_SEAT_CAPABILITIES:
+        printf("seat cap: %u\n", arg->u[0]);
+        break;
+
+    case EVLOG_POINTER_ENTER:
+        printf("wl_pointer_enter\n");
+        pointer->event_mask |= POINTER_EVENT_ENTER;
+        pointer->surface_x = arg->i[1], pointer->surface_y = arg->i[2];
+        break;
+    case EVLOG_POINTER_LEAVE:
+        printf("wl_pointer_leave\n");
+        pointer->event_mask |= POINTER_EVENT_LEAVE;
+        break;
+    case EVLOG_POINTER_MOTION:
+        printf("wl_pointer_motion\n");
+        pointer->event_mask |= POINTER_EVENT_MOTION;
+        pointer->time = record->time;
+        pointer->surface_x = arg->i[0], pointer->surface_y = arg->i[1];
+        break;
+    case EVLOG_POINTER_BUTTON:
+        printf("wl_pointer_button\n");
+        pointer->event_mask |= POINTER_EVENT_BUTTON;
+        pointer->time = record->time;
+        pointer->button = arg->u[1], pointer->state = arg->u[2];
+        break;
+    case EVLOG_POINTER_AXIS:
+        printf("wl_pointer_axis\n");
+        pointer->event_mask |= POINTER_EVENT_AXIS;
+        pointer->time = record->time;
+        pointer->axes[axis].valid = true;
+        pointer->axes[axis].value = arg->i[1];
+        break;
+    case EVLOG_POINTER_AXIS_SOURCE:
+        pointer->event_mask |= POINTER_EVENT_AXIS_SOURCE;
+        pointer->axis_source = arg->u[0];
+        break;
+    case EVLOG_POINTER_AXIS_STOP:
+        pointer->event_mask |= POINTER_EVENT_AXIS_STOP;
+        pointer->time = record->time;
+        pointer->axes[axis].valid = true;
+        break;
+    case EVLOG_POINTER_AXIS_DISCRETE:
+        pointer->event_mask |= POINTER_EVENT_AXIS_DISCRETE;
+        pointer->axes[axis].valid = true;
+        pointer->axes[axis].discrete = arg->i[1];
+        break;
+    case EVLOG_POINTER_FRAME:
+        printf("wl_pointer_frame\n");
+        print_pointer_frame();
+        break;
+    case EVLOG_TOPLEVEL_MOVE:
+        printf("xdg_toplevel_move\n");
+        break;
+
+    case EVLOG_TOUCH_DOWN:
+        printf("wl_touch_down\n");
+        touch_event.time = record->time;
+        if ((i = touch_table_down(points, arg->i[1])) >= 0) {
+            points->event_mask[i] |= TOUCH_EVENT_DOWN;
+            points->x[i] = arg->i[2], points->y[i] = arg->i[3];
+        }
+        break;
+    case EVLOG_TOUCH_UP:
+        printf("wl_touch_up\n");
+        touch_event.time = record->time;
+        if ((i = touch_table_find(points, arg->i[1])) >= 0) {
+            points->event_mask[i] |= TOUCH_EVENT_UP;
+        }
+        break;
+    case EVLOG_TOUCH_MOTION:
+        printf("wl_touch_motion\n");
+        touch_event.time = record->time;
+        if ((i = touch_table_find(points, arg->i[1])) >= 0) {
+            points->event_mask[i] |= TOUCH_EVENT_MOTION;
+            points->x[i] = arg->i[2], points->y[i] = arg->i[3];
+        }
+        break;
+    case EVLOG_TOUCH_CANCEL:
+        printf("wl_touch_cancel\n");
+        touch_table_clear(points);
+        break;
+    case EVLOG_TOUCH_SHAPE:
+        printf("wl_touch_shape\n");
+        if ((i = touch_table_find(points, arg->i[1])) >= 0) {
+            points->event_mask[i] |= TOUCH_EVENT_SHAPE;
+            points->major[i] = arg->i[2], points->minor[i] = arg->i[3];
+        }
+        break;
+    case EVLOG_TOUCH_ORIENTATION:
+        printf("wl_touch_orientation\n");
+        if ((i = touch_table_find(points, arg->i[1])) >= 0) {
+            points->event_mask[i] |= TOUCH_EVENT_ORIENTATION;
+            points->orientation[i] = arg->i[2];
+        }
+        break;
+    case EVLOG_TOUCH_FRAME:
+        printf("wl_touch_frame\n");
+        print_touch_frame();
+        break;
+    case EVLOG_GESTURE:
+        print_gesture(record);
+        break;
+
+    case EVLOG_KEYBOARD_ENTER:
+        printf("keyboard enter; keys pressed are:\n");
+        break;
+    case EVLOG_KEYBOARD_ENTER_KEY:
+        print_key("", arg);
+        break;
+    case EVLOG_KEYBOARD_LEAVE:
+        printf("keyboard leave\n");
+        break;
+    case EVLOG_KEY_PRESS:
+        print_key("key press: ", arg);
+        break;
+    case EVLOG_KEY_RELEASE:
+        print_key("key release: ", arg);
+        break;
+    case EVLOG_KEY_REPEAT:
+        print_key("key repeat: ", arg);
+        break;
+
+    default:
+        printf("unknown record type %u\n", record->type);
+        break;
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    bool timestamps = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t")) != -1) {
+        if (opt != 't') {
+            goto usage;
+        }
+        timestamps = true;
+    }
+    if (optind == argc) {
+        goto usage;
+    }
+
+    if (touch_table_init(&touch_event.points,
+                TOUCH_TABLE_DEFAULT_CAPACITY) < 0) {
+        perror("touch_table_init");
+        return 1;
+    }
+
+    int nrings = 0;
+    struct ring *rings = calloc(argc - optind, sizeof(*rings));
+    for (int i = optind; i < argc; ++i) {
+        if (ring_open(&rings[nrings], argv[i])) {
+            ++nrings;
+        }
+    }
+
+    for (;;) {
+        struct ring *oldest = NULL;
+        const struct evlog_record *record = NULL;
+        for (int i = 0; i < nrings; ++i) {
+            const struct evlog_record *r = ring_peek(&rings[i]);
+            if (r != NULL && (record == NULL || r->ns < record->ns)) {
+                oldest = &rings[i];
+                record = r;
+            }
+        }
+        if (record == NULL) {
+            break;
+        }
+        if (timestamps) {
+            printf("[%llu.%09llu] ",
+                    (unsigned long long)(record->ns / 1000000000),
+                    (unsigned long long)(record->ns % 1000000000));
+        }
+        print_record(record);
+        ++oldest->next;
+    }
+
+    for (int i = 0; i < nrings; ++i) {
+        munmap((void *)rings[i].header, rings[i].size);
+    }
+    free(rings);
+    touch_table_finish(&touch_event.points);
+    return nrings > 0 ? 0 : 1;
+
+usage:
+    fprintf(stderr, "usage: %s [-t] FILE...\n", argv[0]);
+    return 2;
+}
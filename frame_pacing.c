@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include "frame_pacing.h"
+
+void
+frame_pacing_init(struct frame_pacing *pacing, struct frame_stats *stats,
+        uint64_t margin_ns)
+{
+    memset(pacing, 0, sizeof(*pacing));
+    pacing->clock_id = CLOCK_MONOTONIC;
+    pacing->stats = stats;
+    pacing->margin_ns = margin_ns;
+    for (int i = 0; i < FRAME_PACING_MAX_FEEDBACK; ++i) {
+        pacing->feedback[i].pacing = pacing;
+    }
+}
+
+void
+frame_pacing_finish(struct frame_pacing *pacing)
+{
+    for (int i = 0; i < FRAME_PACING_MAX_FEEDBACK; ++i) {
+        if (pacing->feedback[i].feedback != NULL) {
+            wp_presentation_feedback_destroy(pacing->feedback[i].feedback);
+            pacing->feedback[i].feedback = NULL;
+        }
+    }
+    if (pacing->wp_presentation != NULL) {
+        wp_presentation_destroy(pacing->wp_presentation);
+        pacing->wp_presentation = NULL;
+    }
+}
+
+static void
+presentation_clock_id(void *data, struct wp_presentation *wp_presentation,
+        uint32_t clk_id)
+{
+    struct frame_pacing *pacing = data;
+    pacing->clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_clock_id,
+};
+
+void
+frame_pacing_set_presentation(struct frame_pacing *pacing,
+        struct wp_presentation *wp_presentation)
+{
+    pacing->wp_presentation = wp_presentation;
+    wp_presentation_add_listener(wp_presentation,
+            &presentation_listener, pacing);
+}
+
+uint64_t
+frame_pacing_now(const struct frame_pacing *pacing)
+{
+    struct timespec ts;
+    clock_gettime(pacing->clock_id, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+release_feedback(struct frame_pacing_feedback *slot)
+{
+    wp_presentation_feedback_destroy(slot->feedback);
+    slot->feedback = NULL;
+}
+
+static void
+feedback_sync_output(void *data,
+        struct wp_presentation_feedback *wp_presentation_feedback,
+        struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+        struct wp_presentation_feedback *wp_presentation_feedback,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+        uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo, uint32_t flags)
+{
+    struct frame_pacing_feedback *slot = data;
+    struct frame_pacing *pacing = slot->pacing;
+    uint64_t present_ns = ((uint64_t)tv_sec_hi << 32 | tv_sec_lo)
+        * 1000000000ULL + tv_nsec;
+    uint64_t seq = (uint64_t)seq_hi << 32 | seq_lo;
+
+    if (present_ns >= slot->commit_ns) {
+        frame_stats_record(pacing->stats, FRAME_STAGE_PRESENT,
+                present_ns - slot->commit_ns);
+    }
+    /* Every frame callback commits, so a gap in the counter is a miss */
+    if ((flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC) && seq != 0
+            && pacing->last_seq != 0 && seq > pacing->last_seq + 1) {
+        pacing->skipped += seq - pacing->last_seq - 1;
+    }
+    if (seq != 0) {
+        pacing->last_seq = seq;
+    }
+    if (present_ns > pacing->last_present_ns) {
+        pacing->last_present_ns = present_ns;
+    }
+    pacing->refresh_ns = refresh;
+    ++pacing->presented;
+    release_feedback(slot);
+}
+
+static void
+feedback_discarded(void *data,
+        struct wp_presentation_feedback *wp_presentation_feedback)
+{
+    struct frame_pacing_feedback *slot = data;
+    ++slot->pacing->discarded;
+    release_feedback(slot);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented = feedback_presented,
+    .discarded = feedback_discarded,
+};
+
+void
+frame_pacing_commit(struct frame_pacing *pacing,
+        struct wl_surface *wl_surface)
+{
+    if (pacing->wp_presentation == NULL) {
+        return;
+    }
+    /* With every slot taken the compositor is not answering; skip it */
+    for (int i = 0; i < FRAME_PACING_MAX_FEEDBACK; ++i) {
+        struct frame_pacing_feedback *slot = &pacing->feedback[i];
+        if (slot->feedback == NULL) {
+            slot->feedback = wp_presentation_feedback(pacing->wp_presentation,
+                    wl_surface);
+            wp_presentation_feedback_add_listener(slot->feedback,
+                    &feedback_listener, slot);
+            slot->commit_ns = frame_pacing_now(pacing);
+            return;
+        }
+    }
+}
+
+void
+frame_pacing_rendered(struct frame_pacing *pacing, uint64_t ns)
+{
+    /* A slow frame counts right away, a run of fast ones only slowly */
+    if (ns > pacing->render_ns) {
+        pacing->render_ns = ns;
+    } else {
+        pacing->render_ns -= (pacing->render_ns - ns) / 16;
+    }
+}
+
+/* The first refresh still ahead of now, extrapolated from the last one */
+static uint64_t
+next_refresh(const struct frame_pacing *pacing, uint64_t now)
+{
+    uint64_t next = pacing->last_present_ns + pacing->refresh_ns;
+    if (next <= now) {
+        uint64_t behind = now - next;
+        next += (behind / pacing->refresh_ns + 1) * pacing->refresh_ns;
+    }
+    return next;
+}
+
+uint64_t
+frame_pacing_delay(const struct frame_pacing *pacing)
+{
+    if (pacing->margin_ns == 0 || pacing->refresh_ns == 0
+            || pacing->last_present_ns == 0) {
+        return 0;
+    }
+
+    uint64_t now = frame_pacing_now(pacing);
+    uint64_t next = next_refresh(pacing, now);
+    uint64_t needed = pacing->margin_ns + pacing->render_ns;
+    if (next - now <= needed) {
+        return 0;
+    }
+    return next - now - needed;
+}
+
+uint64_t
+frame_pacing_next_present(const struct frame_pacing *pacing)
+{
+    if (pacing->refresh_ns == 0 || pacing->last_present_ns == 0) {
+        return 0;
+    }
+    uint64_t now = frame_pacing_now(pacing);
+    return next_refresh(pacing, now) - now + frame_stats_now();
+}
+
+void
+frame_pacing_report(const struct frame_pacing *pacing, FILE *out)
+{
+    if (pacing->wp_presentation == NULL) {
+        fprintf(out, "  no wp_presentation, nothing known about "
+                "presentation\n");
+        return;
+    }
+    fprintf(out, "  refresh %.3f ms, %llu presented, %llu discarded, "
+            "%llu refreshes skipped, render estimate %.1f us\n",
+            pacing->refresh_ns / 1e6,
+            (unsigned long long)pacing->presented,
+            (unsigned long long)pacing->discarded,
+            (unsigned long long)pacing->skipped,
+            pacing->render_ns / 1e3);
+}
@@ -0,0 +1,85 @@
+#ifndef FRAME_PACING_H
+#define FRAME_PACING_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <wayland-client.h>
+#include "frame_stats.h"
+#include "presentation-time-client-protocol.h"
+
+/* Commits whose presentation feedback may be outstanding at once */
+#define FRAME_PACING_MAX_FEEDBACK 8
+
+struct frame_pacing;
+
+struct frame_pacing_feedback {
+    struct frame_pacing *pacing;
+    /* NULL while the slot is free */
+    struct wp_presentation_feedback *feedback;
+    uint64_t commit_ns;
+};
+
+/*
+ * Follows wp_presentation feedback for every commit: when frames were
+ * actually shown, the output's refresh period and its refresh counter.
+ * From that it records commit-to-present latency, counts refreshes that
+ * went by without a new frame, and tells the frame callback how long it
+ * may wait before rendering and still make the next refresh.
+ *
+ * All times are in the presentation clock, see frame_pacing_now().
+ */
+struct frame_pacing {
+    struct wp_presentation *wp_presentation;
+    clockid_t clock_id;
+    struct frame_stats *stats;
+
+    /* Both 0 until the first presented event */
+    uint64_t last_present_ns;
+    uint64_t refresh_ns;
+    uint64_t last_seq;
+    /* Render start to commit; jumps up at once, comes down slowly */
+    uint64_t render_ns;
+    /* How long before a refresh the compositor must have the commit;
+     * 0 renders as soon as the frame callback arrives */
+    uint64_t margin_ns;
+
+    uint64_t presented, discarded, skipped;
+    struct frame_pacing_feedback feedback[FRAME_PACING_MAX_FEEDBACK];
+};
+
+/* Latency goes into stats as FRAME_STAGE_PRESENT */
+void frame_pacing_init(struct frame_pacing *pacing, struct frame_stats *stats,
+        uint64_t margin_ns);
+/* Destroys the feedback still outstanding and the wp_presentation */
+void frame_pacing_finish(struct frame_pacing *pacing);
+
+/* Takes ownership of the bound global; without one nothing is measured */
+void frame_pacing_set_presentation(struct frame_pacing *pacing,
+        struct wp_presentation *wp_presentation);
+
+uint64_t frame_pacing_now(const struct frame_pacing *pacing);
+
+/* Call right before wl_surface_commit() to get feedback on that commit */
+void frame_pacing_commit(struct frame_pacing *pacing,
+        struct wl_surface *wl_surface);
+
+/* How long the frame just committed took, from starting on it */
+void frame_pacing_rendered(struct frame_pacing *pacing, uint64_t ns);
+
+/*
+ * ns to wait, from the frame callback, before starting on the frame so
+ * that it is committed margin_ns before the next refresh. 0 when pacing
+ * is off or there is nothing to predict from yet.
+ */
+uint64_t frame_pacing_delay(const struct frame_pacing *pacing);
+
+/*
+ * When the next refresh will be, in CLOCK_MONOTONIC like frame_stats_now()
+ * rather than the presentation clock; 0 if nothing is known yet.
+ */
+uint64_t frame_pacing_next_present(const struct frame_pacing *pacing);
+
+void frame_pacing_report(const struct frame_pacing *pacing, FILE *out);
+
+#endif
@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <time.h>
+#include "frame_stats.h"
+
+#define SUB_COUNT (1u << FRAME_HISTOGRAM_SUB_BITS)
+
+static const char *const stage_names[FRAME_STAGE_COUNT] = {
+    [FRAME_STAGE_INTERVAL] = "interval",
+    [FRAME_STAGE_RENDER] = "render",
+    [FRAME_STAGE_PAINT] = "paint",
+    [FRAME_STAGE_ATTACH] = "attach",
+    [FRAME_STAGE_COMMIT] = "commit",
+    [FRAME_STAGE_FLUSH] = "flush",
+    [FRAME_STAGE_TOTAL] = "total",
+    [FRAME_STAGE_PRESENT] = "present",
+};
+
+void
+frame_stats_init(struct frame_stats *stats, uint64_t deadline_ns)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->deadline_ns = deadline_ns;
+}
+
+uint64_t
+frame_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned
+bucket_index(uint64_t ns)
+{
+    if (ns < SUB_COUNT) {
+        return ns;
+    }
+    unsigned exp = 63 - __builtin_clzll(ns);
+    if (exp >= FRAME_HISTOGRAM_MAX_EXP) {
+        return FRAME_HISTOGRAM_BUCKETS - 1;
+    }
+    /* The top SUB_BITS + 1 bits, the leading one selecting the group */
+    unsigned shift = exp - FRAME_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << FRAME_HISTOGRAM_SUB_BITS)
+        + (unsigned)(ns >> shift) - SUB_COUNT;
+}
+
+/* The middle of the range of values that fall in bucket index */
+static uint64_t
+bucket_value(unsigned index)
+{
+    if (index < SUB_COUNT) {
+        return index;
+    }
+    unsigned shift = (index >> FRAME_HISTOGRAM_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + index % SUB_COUNT) << shift;
+    return low + ((1ULL << shift) >> 1);
+}
+
+static void
+increment(_Atomic uint64_t *counter)
+{
+    atomic_store_explicit(counter,
+            atomic_load_explicit(counter, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+}
+
+void
+frame_histogram_record(struct frame_histogram *histogram, uint64_t ns)
+{
+    increment(&histogram->buckets[bucket_index(ns)]);
+    increment(&histogram->count);
+    if (ns > atomic_load_explicit(&histogram->max, memory_order_relaxed)) {
+        atomic_store_explicit(&histogram->max, ns, memory_order_relaxed);
+    }
+}
+
+void
+frame_stats_record(struct frame_stats *stats, enum frame_stage stage,
+        uint64_t ns)
+{
+    frame_histogram_record(&stats->stages[stage], ns);
+}
+
+uint64_t
+frame_stats_begin(struct frame_stats *stats)
+{
+    uint64_t now = frame_stats_now();
+    if (stats->last_callback_ns != 0) {
+        uint64_t interval = now - stats->last_callback_ns;
+        frame_stats_record(stats, FRAME_STAGE_INTERVAL, interval);
+        /* Half a period of slack for jitter in when we get to run */
+        if (interval > stats->deadline_ns + stats->deadline_ns / 2) {
+            increment(&stats->missed_frames);
+        }
+    }
+    stats->last_callback_ns = now;
+    return now;
+}
+
+uint64_t
+frame_stats_lap(struct frame_stats *stats, enum frame_stage stage,
+        uint64_t start)
+{
+    uint64_t now = frame_stats_now();
+    frame_stats_record(stats, stage, now - start);
+    return now;
+}
+
+void
+frame_stats_end(struct frame_stats *stats, uint64_t begin)
+{
+    uint64_t total = frame_stats_now() - begin;
+    frame_stats_record(stats, FRAME_STAGE_TOTAL, total);
+    if (total > stats->deadline_ns) {
+        increment(&stats->late_frames);
+    }
+}
+
+uint64_t
+frame_histogram_percentile(const struct frame_histogram *histogram,
+        double p)
+{
+    uint64_t count = atomic_load_explicit(&histogram->count,
+            memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+    /* The rank of the sample we want, counting from 1 */
+    uint64_t rank = (uint64_t)(p * count);
+    if (rank < p * count || rank == 0) {
+        ++rank;
+    }
+
+    uint64_t max = atomic_load_explicit(&histogram->max,
+            memory_order_relaxed);
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < FRAME_HISTOGRAM_BUCKETS; ++i) {
+        seen += atomic_load_explicit(&histogram->buckets[i],
+                memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t value = bucket_value(i);
+            return value < max ? value : max;
+        }
+    }
+    /* Counted but not bucketed yet by a concurrent writer */
+    return max;
+}
+
+void
+frame_histogram_report_scaled(const struct frame_histogram *histogram,
+        const char *name, double divisor, FILE *out)
+{
+    fprintf(out, "  %-8s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+            name,
+            (unsigned long long)atomic_load_explicit(&histogram->count,
+                memory_order_relaxed),
+            frame_histogram_percentile(histogram, 0.50) / divisor,
+            frame_histogram_percentile(histogram, 0.99) / divisor,
+            frame_histogram_percentile(histogram, 0.999) / divisor,
+            atomic_load_explicit(&histogram->max,
+                memory_order_relaxed) / divisor);
+}
+
+void
+frame_histogram_report(const struct frame_histogram *histogram,
+        const char *name, FILE *out)
+{
+    frame_histogram_report_scaled(histogram, name, 1e3, out);
+}
+
+void
+frame_stats_report(const struct frame_stats *stats, FILE *out)
+{
+    fprintf(out, "frame timing, us (deadline %.3f ms):\n",
+            stats->deadline_ns / 1e6);
+    fprintf(out, FRAME_HISTOGRAM_HEADER, "stage");
+    for (int i = 0; i < FRAME_STAGE_COUNT; ++i) {
+        frame_histogram_report(&stats->stages[i], stage_names[i], out);
+    }
+    fprintf(out, "  late frames: %llu, missed refreshes: %llu\n",
+            (unsigned long long)atomic_load_explicit(&stats->late_frames,
+                memory_order_relaxed),
+            (unsigned long long)atomic_load_explicit(&stats->missed_frames,
+                memory_order_relaxed));
+}
@@ -0,0 +1,108 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Log-linear buckets: values below 2^FRAME_HISTOGRAM_SUB_BITS ns are exact,
+ * above that every power of two is split in 2^FRAME_HISTOGRAM_SUB_BITS
+ * buckets, so a percentile is off by at most 1/32 of its value. Anything
+ * from 2^FRAME_HISTOGRAM_MAX_EXP ns (about 18 minutes) up lands in the
+ * last bucket.
+ */
+#define FRAME_HISTOGRAM_SUB_BITS 5
+#define FRAME_HISTOGRAM_MAX_EXP 40
+#define FRAME_HISTOGRAM_BUCKETS \
+    ((FRAME_HISTOGRAM_MAX_EXP - FRAME_HISTOGRAM_SUB_BITS + 1) \
+            << FRAME_HISTOGRAM_SUB_BITS)
+
+enum frame_stage {
+    /* From one frame callback arriving to the next */
+    FRAME_STAGE_INTERVAL,
+    /* Getting the frame to attach: painting it, or taking it from the
+     * render thread */
+    FRAME_STAGE_RENDER,
+    /* The pixel work alone, on whichever thread did it */
+    FRAME_STAGE_PAINT,
+    FRAME_STAGE_ATTACH,
+    FRAME_STAGE_COMMIT,
+    FRAME_STAGE_FLUSH,
+    /* From starting on the frame (the callback arriving, or the pacing
+     * timer firing) to the flush being done */
+    FRAME_STAGE_TOTAL,
+    /* From the commit to the frame being shown, per wp_presentation */
+    FRAME_STAGE_PRESENT,
+    FRAME_STAGE_COUNT,
+};
+
+/*
+ * Each histogram has a single writer at a time, so counting is a relaxed
+ * load and store rather than a locked add; a reader on another thread sees
+ * every count some time after it was made, never a torn one.
+ */
+struct frame_histogram {
+    _Atomic uint64_t count;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[FRAME_HISTOGRAM_BUCKETS];
+};
+
+struct frame_stats {
+    uint64_t deadline_ns;
+    uint64_t last_callback_ns;
+    /* Frames whose TOTAL went over the deadline */
+    _Atomic uint64_t late_frames;
+    /* Callback intervals long enough that a whole refresh went by */
+    _Atomic uint64_t missed_frames;
+    struct frame_histogram stages[FRAME_STAGE_COUNT];
+};
+
+/* deadline_ns is the time one frame may take, a refresh period */
+void frame_stats_init(struct frame_stats *stats, uint64_t deadline_ns);
+
+/* CLOCK_MONOTONIC in ns, what all the stage times are measured with */
+uint64_t frame_stats_now(void);
+
+void frame_stats_record(struct frame_stats *stats, enum frame_stage stage,
+        uint64_t ns);
+
+/*
+ * Call when a frame callback arrives; records the interval since the last
+ * one and returns the time, to be passed to frame_stats_lap() and
+ * frame_stats_end().
+ */
+uint64_t frame_stats_begin(struct frame_stats *stats);
+
+/* Records the time since start for stage and returns the time now */
+uint64_t frame_stats_lap(struct frame_stats *stats, enum frame_stage stage,
+        uint64_t start);
+
+/* Records the TOTAL of the frame begun at begin and checks the deadline */
+void frame_stats_end(struct frame_stats *stats, uint64_t begin);
+
+void frame_histogram_record(struct frame_histogram *histogram, uint64_t ns);
+
+/* The value at or below which a fraction p of the samples lie, 0 if none */
+uint64_t frame_histogram_percentile(const struct frame_histogram *histogram,
+        double p);
+
+/* Column titles for frame_histogram_report(), the first one a format arg */
+#define FRAME_HISTOGRAM_HEADER \
+    "  %-8s      count        p50        p99      p99.9        max\n"
+
+/* One row of count, p50, p99, p99.9 and max, in us */
+void frame_histogram_report(const struct frame_histogram *histogram,
+        const char *name, FILE *out);
+
+/*
+ * The same for a histogram of something other than ns, each value divided
+ * by divisor, e.g. 1000 for a histogram of 1/1000 px to report px.
+ */
+void frame_histogram_report_scaled(const struct frame_histogram *histogram,
+        const char *name, double divisor, FILE *out);
+
+/* A table of p50/p99/p99.9/max per stage plus the deadline counters */
+void frame_stats_report(const struct frame_stats *stats, FILE *out);
+
+#endif
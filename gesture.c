@@ -0,0 +1,196 @@
+#include <math.h>
+#include <string.h>
+#include "gesture.h"
+
+void
+gesture_init(struct gesture *gesture, gesture_func func, void *data)
+{
+    memset(gesture, 0, sizeof(*gesture));
+    gesture->config = (struct gesture_config){
+        .tap_ms = GESTURE_DEFAULT_TAP_MS,
+        .tap_slop = GESTURE_DEFAULT_TAP_SLOP,
+        .pan_slop = GESTURE_DEFAULT_PAN_SLOP,
+        .pinch_slop = GESTURE_DEFAULT_PINCH_SLOP,
+        .rotate_slop = GESTURE_DEFAULT_ROTATE_SLOP,
+    };
+    gesture->func = func;
+    gesture->data = data;
+    gesture->scale = 1;
+}
+
+/* Hands out what built up for type and starts it over */
+static void
+emit(struct gesture *gesture, enum gesture_type type,
+        enum gesture_phase phase, uint32_t time)
+{
+    struct gesture_event event = {
+        .type = type,
+        .phase = phase,
+        .time = time,
+        .fingers = gesture->fingers,
+        .x = gesture->x,
+        .y = gesture->y,
+        .scale = 1,
+    };
+    switch (type) {
+    case GESTURE_PAN:
+        event.dx = gesture->dx;
+        event.dy = gesture->dy;
+        gesture->dx = gesture->dy = 0;
+        break;
+    case GESTURE_PINCH:
+        event.scale = gesture->scale;
+        gesture->scale = 1;
+        break;
+    case GESTURE_ROTATE:
+        event.rotation = gesture->rotation;
+        gesture->rotation = 0;
+        break;
+    default:
+        break;
+    }
+    gesture->func(gesture->data, &event);
+}
+
+/* Begins type once crossed, then reports it whenever it changed */
+static void
+update(struct gesture *gesture, enum gesture_type type, bool crossed,
+        bool changed, uint32_t time)
+{
+    if (!gesture->active[type]) {
+        if (crossed) {
+            gesture->active[type] = true;
+            emit(gesture, type, GESTURE_BEGIN, time);
+        }
+    } else if (changed) {
+        emit(gesture, type, GESTURE_UPDATE, time);
+    }
+}
+
+static void
+end_stroke(struct gesture *gesture, enum gesture_phase phase, uint32_t time)
+{
+    bool any = false;
+    for (int type = 0; type < GESTURE_TYPE_COUNT; ++type) {
+        if (gesture->active[type]) {
+            any = true;
+            /* Everything has been reported already */
+            gesture->dx = gesture->dy = gesture->rotation = 0;
+            gesture->scale = 1;
+            emit(gesture, type, phase, time);
+        }
+    }
+    if (!any && phase == GESTURE_END
+            && time - gesture->start_time <= gesture->config.tap_ms
+            && gesture->travel <= gesture->config.tap_slop) {
+        emit(gesture, GESTURE_TAP, GESTURE_END, time);
+    }
+    gesture->stroke = false;
+}
+
+void
+gesture_frame(struct gesture *gesture, const struct touch_table *table,
+        uint32_t time)
+{
+    uint32_t count = table->count;
+    if (count == 0) {
+        return;
+    }
+    if (!gesture->stroke) {
+        gesture->stroke = true;
+        gesture->start_time = time;
+        gesture->fingers = 0;
+        gesture->travel = 0;
+        gesture->dx = gesture->dy = gesture->rotation = 0;
+        gesture->scale = 1;
+        memset(gesture->active, 0, sizeof(gesture->active));
+    }
+    if (count > gesture->fingers) {
+        gesture->fingers = count;
+    }
+
+    /* Steady contacts were down a frame ago and still are */
+    double sx = 0, sy = 0;
+    double last_sx = 0, last_sy = 0, steady_sx = 0, steady_sy = 0;
+    uint32_t steady = 0, live = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t mask = table->event_mask[i];
+        double x = wl_fixed_to_double(table->x[i]);
+        double y = wl_fixed_to_double(table->y[i]);
+        sx += x;
+        sy += y;
+        if (!(mask & TOUCH_EVENT_UP)) {
+            ++live;
+        }
+        if (!(mask & (TOUCH_EVENT_DOWN | TOUCH_EVENT_UP))) {
+            ++steady;
+            steady_sx += x;
+            steady_sy += y;
+            last_sx += wl_fixed_to_double(table->last_x[i]);
+            last_sy += wl_fixed_to_double(table->last_y[i]);
+        }
+    }
+    gesture->x = sx / count;
+    gesture->y = sy / count;
+
+    double dx = 0, dy = 0, scale = 1, rotation = 0;
+    if (steady > 0) {
+        double cx = steady_sx / steady, cy = steady_sy / steady;
+        double last_cx = last_sx / steady, last_cy = last_sy / steady;
+        dx = cx - last_cx;
+        dy = cy - last_cy;
+        gesture->travel += hypot(dx, dy);
+
+        if (steady >= 2) {
+            /* The turn is the angle of the summed before/after products */
+            double spread = 0, last_spread = 0, cross = 0, dot = 0;
+            const uint32_t unsteady = TOUCH_EVENT_DOWN | TOUCH_EVENT_UP;
+            for (uint32_t i = 0; i < count; ++i) {
+                if (table->event_mask[i] & unsteady) {
+                    continue;
+                }
+                double px = wl_fixed_to_double(table->last_x[i]) - last_cx;
+                double py = wl_fixed_to_double(table->last_y[i]) - last_cy;
+                double qx = wl_fixed_to_double(table->x[i]) - cx;
+                double qy = wl_fixed_to_double(table->y[i]) - cy;
+                last_spread += hypot(px, py);
+                spread += hypot(qx, qy);
+                cross += px * qy - py * qx;
+                dot += px * qx + py * qy;
+            }
+            /* All on one spot, neither has a meaning */
+            if (last_spread > 1e-6 && spread > 1e-6) {
+                scale = spread / last_spread;
+                rotation = atan2(cross, dot);
+            }
+            gesture->travel += fabs(spread - last_spread) / steady;
+        }
+    }
+
+    gesture->dx += dx;
+    gesture->dy += dy;
+    gesture->scale *= scale;
+    gesture->rotation += rotation;
+    const struct gesture_config *config = &gesture->config;
+    update(gesture, GESTURE_PAN,
+            hypot(gesture->dx, gesture->dy) > config->pan_slop,
+            dx != 0 || dy != 0, time);
+    update(gesture, GESTURE_PINCH,
+            fabs(log(gesture->scale)) > log1p(config->pinch_slop),
+            scale != 1, time);
+    update(gesture, GESTURE_ROTATE,
+            fabs(gesture->rotation) > config->rotate_slop,
+            rotation != 0, time);
+
+    if (live == 0) {
+        end_stroke(gesture, GESTURE_END, time);
+    }
+}
+
+void
+gesture_cancel(struct gesture *gesture, uint32_t time)
+{
+    if (gesture->stroke) {
+        end_stroke(gesture, GESTURE_CANCEL, time);
+    }
+}
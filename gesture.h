@@ -0,0 +1,108 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "touch_table.h"
+
+/* Thresholds gesture_init() starts with */
+#define GESTURE_DEFAULT_TAP_MS 250
+#define GESTURE_DEFAULT_TAP_SLOP 10.0
+#define GESTURE_DEFAULT_PAN_SLOP 16.0
+#define GESTURE_DEFAULT_PINCH_SLOP 0.1
+#define GESTURE_DEFAULT_ROTATE_SLOP 0.2
+
+enum gesture_type {
+    GESTURE_TAP,
+    GESTURE_PAN,
+    GESTURE_PINCH,
+    GESTURE_ROTATE,
+    GESTURE_TYPE_COUNT,
+};
+
+enum gesture_phase {
+    GESTURE_BEGIN,
+    GESTURE_UPDATE,
+    /* The contacts lifted; a tap only ever ends */
+    GESTURE_END,
+    /* The compositor took the touches over */
+    GESTURE_CANCEL,
+};
+
+struct gesture_event {
+    enum gesture_type type;
+    enum gesture_phase phase;
+    /* The touch frame's Wayland timestamp in ms */
+    uint32_t time;
+    /* Most contacts down at once so far */
+    uint32_t fingers;
+    /* Centroid of the contacts, surface coordinates */
+    double x, y;
+    /*
+     * Change since the gesture's last event, the first one carrying what
+     * built up before it began: pan dx, dy in px, pinch scale as a factor,
+     * rotate rotation in radians, clockwise on screen.
+     */
+    double dx, dy;
+    double scale;
+    double rotation;
+};
+
+typedef void (*gesture_func)(void *data, const struct gesture_event *event);
+
+struct gesture_config {
+    /* Longest touch that still taps, and how far it may wander in px */
+    uint32_t tap_ms;
+    double tap_slop;
+    /* How far the centroid moves, in px, before a pan begins */
+    double pan_slop;
+    /* How much the contacts spread or close, as a fraction, for a pinch */
+    double pinch_slop;
+    /* How far they turn about the centroid, in radians, for a rotate */
+    double rotate_slop;
+};
+
+/*
+ * Recognizes taps, pans, pinches and rotations from the touch table at
+ * each wl_touch.frame, in one or two passes over the contacts. Only the
+ * contacts down in both this frame and the last count towards motion: the
+ * centroid's shift is the pan, the change of their mean distance from it
+ * the pinch, and their mean turn about it the rotation. A finger going
+ * down or up mid-gesture therefore neither jumps nor resets it.
+ *
+ * Pan, pinch and rotate each begin once their own threshold is crossed
+ * and can run at the same time; all of them end when the last contact
+ * lifts. A stroke that ended before any of them began and stayed short
+ * and still is a tap.
+ */
+struct gesture {
+    /* Set by gesture_init(), may be changed any time after */
+    struct gesture_config config;
+    gesture_func func;
+    void *data;
+
+    /* From the first contact down to the last one up */
+    bool stroke;
+    uint32_t start_time;
+    uint32_t fingers;
+    /* Centroid path plus spread change so far, what rules out a tap */
+    double travel;
+
+    bool active[GESTURE_TYPE_COUNT];
+    /* What built up since the last event of each, or since the stroke */
+    double dx, dy;
+    double scale;
+    double rotation;
+    double x, y;
+};
+
+void gesture_init(struct gesture *gesture, gesture_func func, void *data);
+
+/* At wl_touch.frame, before touch_table_end_frame() */
+void gesture_frame(struct gesture *gesture, const struct touch_table *table,
+        uint32_t time);
+
+/* At wl_touch.cancel: cancels whatever is recognized, the stroke is over */
+void gesture_cancel(struct gesture *gesture, uint32_t time);
+
+#endif
@@ -0,0 +1,1372 @@
+/*
+ * A stand-in compositor for running the client without a GPU or a display.
+ * It starts the client over a socketpair and implements just enough of
+ * wl_compositor, wl_shm, xdg_wm_base, wl_seat and wp_presentation to drive
+ * it: scripted configure sizes, synthetic input at fixed rates, frame
+ * callbacks on a virtual clock and a checksum of every buffer the client
+ * commits.
+ *
+ *     cc -o headless_compositor headless_compositor.c xdg-shell.c \
+ *             presentation-time.c -lwayland-server -lm
+ *     headless_compositor [options] -- ./wayland_input_exam
+ *
+ * Without -R, a vblank happens as soon as the client has committed since
+ * the last one, so the run measures how fast the client can go. The
+ * summary printed at the end has the frame count, the wall time and a
+ * checksum over everything committed, which stays the same across runs
+ * as long as the output does. Presentation feedback reports the
+ * CLOCK_MONOTONIC time of the vblank and the virtual refresh period.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server.h>
+#include "presentation-time-server-protocol.h"
+#include "xdg-shell-server-protocol.h"
+
+#define MAX_SIZES 16
+/* Vblank anyway if the client has not committed for this long, wall ms */
+#define STALL_TIMEOUT_MS 100
+/* Kill the client if it is still connected this long after close */
+#define CLOSE_TIMEOUT_MS 2000
+/* Touch strokes: down, this many motions, up */
+#define TOUCH_STROKE_MOTIONS 32
+
+/*
+ * Enough of a keymap for the letters and space, with no includes, so it
+ * compiles on machines without xkeyboard-config installed.
+ */
+static const char keymap_text[] =
+    "xkb_keymap {\n"
+    "xkb_keycodes \"headless\" {\n"
+    "    minimum = 8;\n"
+    "    maximum = 255;\n"
+    "    <AD01> = 24; <AD02> = 25; <AD03> = 26; <AD04> = 27; <AD05> = 28;\n"
+    "    <AD06> = 29; <AD07> = 30; <AD08> = 31; <AD09> = 32; <AD10> = 33;\n"
+    "    <AC01> = 38; <AC02> = 39; <AC03> = 40; <AC04> = 41; <AC05> = 42;\n"
+    "    <AC06> = 43; <AC07> = 44; <AC08> = 45; <AC09> = 46;\n"
+    "    <AB01> = 52; <AB02> = 53; <AB03> = 54; <AB04> = 55; <AB05> = 56;\n"
+    "    <AB06> = 57; <AB07> = 58;\n"
+    "    <SPCE> = 65;\n"
+    "};\n"
+    "xkb_types \"headless\" {\n"
+    "    type \"ONE_LEVEL\" {\n"
+    "        modifiers = none;\n"
+    "        level_name[Level1] = \"Any\";\n"
+    "    };\n"
+    "    type \"ALPHABETIC\" {\n"
+    "        modifiers = Shift+Lock;\n"
+    "        map[Shift] = Level2;\n"
+    "        map[Lock] = Level2;\n"
+    "        level_name[Level1] = \"Base\";\n"
+    "        level_name[Level2] = \"Caps\";\n"
+    "    };\n"
+    "};\n"
+    "xkb_compatibility \"headless\" {\n"
+    "};\n"
+    "xkb_symbols \"headless\" {\n"
+    "    key <AD01> { [ q, Q ] }; key <AD02> { [ w, W ] };\n"
+    "    key <AD03> { [ e, E ] }; key <AD04> { [ r, R ] };\n"
+    "    key <AD05> { [ t, T ] }; key <AD06> { [ y, Y ] };\n"
+    "    key <AD07> { [ u, U ] }; key <AD08> { [ i, I ] };\n"
+    "    key <AD09> { [ o, O ] }; key <AD10> { [ p, P ] };\n"
+    "    key <AC01> { [ a, A ] }; key <AC02> { [ s, S ] };\n"
+    "    key <AC03> { [ d, D ] }; key <AC04> { [ f, F ] };\n"
+    "    key <AC05> { [ g, G ] }; key <AC06> { [ h, H ] };\n"
+    "    key <AC07> { [ j, J ] }; key <AC08> { [ k, K ] };\n"
+    "    key <AC09> { [ l, L ] };\n"
+    "    key <AB01> { [ z, Z ] }; key <AB02> { [ x, X ] };\n"
+    "    key <AB03> { [ c, C ] }; key <AB04> { [ v, V ] };\n"
+    "    key <AB05> { [ b, B ] }; key <AB06> { [ n, N ] };\n"
+    "    key <AB07> { [ m, M ] };\n"
+    "    key <SPCE> { [ space ] };\n"
+    "};\n"
+    "};\n";
+
+/* evdev codes of the keys above, typed in a loop */
+static const uint32_t typed_keys[] = {
+    20, 35, 18, 57, 16, 22, 23, 45, 37, 57, 48, 19, 24, 17, 49,
+};
+
+struct options {
+    uint64_t frames;
+    int refresh_hz;
+    bool realtime;
+    bool verbose;
+    int nsizes;
+    struct { int32_t width, height; } sizes[MAX_SIZES];
+    uint64_t resize_every;
+    int pointer_hz, key_hz, touch_hz;
+    /* Contacts per touch stroke */
+    int touch_fingers;
+    /* If set, strokes are a down held still this long, then an up */
+    int touch_hold_ms;
+};
+
+struct surface;
+
+struct compositor {
+    struct options options;
+    struct wl_display *display;
+    struct wl_event_loop *loop;
+    struct wl_client *client;
+    struct wl_listener client_destroy;
+    pid_t child;
+
+    struct wl_list surfaces;
+    struct wl_list pointers, keyboards, touches;
+    /* The toplevel input goes to, once it has a buffer */
+    struct surface *focus;
+    bool pointer_entered, keyboard_entered;
+
+    uint64_t period_ns, vclock_ns, frame;
+    uint64_t next_pointer_ns, next_key_ns, next_touch_ns;
+    uint32_t pointer_events, key_events, touch_events;
+    /* With -H, the contacts are down and when they went */
+    bool touch_held;
+    uint64_t touch_down_ns;
+    int size_index;
+    bool committed, closing;
+    uint64_t close_wall_ns;
+
+    int keymap_fd;
+    uint64_t commits, checksum;
+};
+
+struct surface {
+    struct compositor *compositor;
+    struct wl_resource *resource;
+    struct wl_list link;
+
+    struct wl_resource *pending_buffer;
+    struct wl_listener pending_buffer_destroy;
+    bool attached;
+    struct wl_list pending_frames;
+    struct wl_list pending_feedback;
+
+    struct wl_resource *buffer;
+    struct wl_listener buffer_destroy;
+    int32_t width, height;
+    /* Committed, waiting for the next vblank */
+    struct wl_list frames;
+    struct wl_list feedback;
+
+    struct wl_resource *xdg_surface;
+    struct wl_resource *xdg_toplevel;
+    bool configured;
+};
+
+static uint64_t
+wall_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t
+vclock_ms(uint64_t ns)
+{
+    return ns / 1000000;
+}
+
+static void
+unlink_resource(struct wl_resource *resource)
+{
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void
+destroy_resource(struct wl_client *client, struct wl_resource *resource)
+{
+    wl_resource_destroy(resource);
+}
+
+static void
+destroy_resource_list(struct wl_list *list)
+{
+    struct wl_resource *resource, *tmp;
+    wl_resource_for_each_safe(resource, tmp, list) {
+        wl_resource_destroy(resource);
+    }
+}
+
+/* FNV-1a over the visible pixels, so stride padding does not count */
+static uint64_t
+checksum_buffer(struct wl_shm_buffer *shm)
+{
+    int32_t width = wl_shm_buffer_get_width(shm);
+    int32_t height = wl_shm_buffer_get_height(shm);
+    int32_t stride = wl_shm_buffer_get_stride(shm);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    wl_shm_buffer_begin_access(shm);
+    const uint8_t *data = wl_shm_buffer_get_data(shm);
+    for (int32_t y = 0; y < height; ++y) {
+        const uint8_t *row = data + (size_t)y * stride;
+        for (int32_t x = 0; x < width * 4; ++x) {
+            hash ^= row[x];
+            hash *= 0x100000001b3ULL;
+        }
+    }
+    wl_shm_buffer_end_access(shm);
+    return hash;
+}
+
+static void
+discard_feedback(struct wl_list *list)
+{
+    struct wl_resource *feedback, *tmp;
+    wl_resource_for_each_safe(feedback, tmp, list) {
+        wp_presentation_feedback_send_discarded(feedback);
+        wl_resource_destroy(feedback);
+    }
+}
+
+static void
+send_configure(struct compositor *compositor, struct surface *surface)
+{
+    int32_t width = 0, height = 0;
+    if (compositor->options.nsizes > 0) {
+        width = compositor->options.sizes[compositor->size_index].width;
+        height = compositor->options.sizes[compositor->size_index].height;
+    }
+    struct wl_array states;
+    wl_array_init(&states);
+    xdg_toplevel_send_configure(surface->xdg_toplevel, width, height, &states);
+    wl_array_release(&states);
+    xdg_surface_send_configure(surface->xdg_surface,
+            wl_display_next_serial(compositor->display));
+    surface->configured = true;
+}
+
+static void
+handle_pending_buffer_destroy(struct wl_listener *listener, void *data)
+{
+    struct surface *surface =
+        wl_container_of(listener, surface, pending_buffer_destroy);
+    surface->pending_buffer = NULL;
+    wl_list_remove(&listener->link);
+    wl_list_init(&listener->link);
+}
+
+static void
+handle_buffer_destroy(struct wl_listener *listener, void *data)
+{
+    struct surface *surface = wl_container_of(listener, surface, buffer_destroy);
+    surface->buffer = NULL;
+    wl_list_remove(&listener->link);
+    wl_list_init(&listener->link);
+}
+
+static void
+surface_attach(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *buffer, int32_t x, int32_t y)
+{
+    struct surface *surface = wl_resource_get_user_data(resource);
+    wl_list_remove(&surface->pending_buffer_destroy.link);
+    wl_list_init(&surface->pending_buffer_destroy.link);
+    surface->pending_buffer = buffer;
+    surface->attached = true;
+    if (buffer != NULL) {
+        wl_resource_add_destroy_listener(buffer,
+                &surface->pending_buffer_destroy);
+    }
+}
+
+static void
+surface_damage(struct wl_client *client, struct wl_resource *resource,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+    /* Everything is checksummed anyway */
+}
+
+static void
+surface_frame(struct wl_client *client, struct wl_resource *resource,
+        uint32_t id)
+{
+    struct surface *surface = wl_resource_get_user_data(resource);
+    struct wl_resource *callback =
+        wl_resource_create(client, &wl_callback_interface, 1, id);
+    if (callback == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(callback, NULL, NULL, unlink_resource);
+    wl_list_insert(surface->pending_frames.prev,
+            wl_resource_get_link(callback));
+}
+
+static void
+surface_set_region(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *region)
+{
+}
+
+static void
+surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+    struct surface *surface = wl_resource_get_user_data(resource);
+    struct compositor *compositor = surface->compositor;
+
+    if (surface->attached) {
+        struct wl_resource *buffer = surface->pending_buffer;
+        wl_list_remove(&surface->pending_buffer_destroy.link);
+        wl_list_init(&surface->pending_buffer_destroy.link);
+        surface->pending_buffer = NULL;
+        surface->attached = false;
+
+        /* The old buffer has been "presented" and can go back */
+        if (surface->buffer != NULL && surface->buffer != buffer) {
+            wl_buffer_send_release(surface->buffer);
+        }
+        wl_list_remove(&surface->buffer_destroy.link);
+        wl_list_init(&surface->buffer_destroy.link);
+        surface->buffer = buffer;
+
+        struct wl_shm_buffer *shm = buffer ? wl_shm_buffer_get(buffer) : NULL;
+        if (shm != NULL) {
+            wl_resource_add_destroy_listener(buffer, &surface->buffer_destroy);
+            surface->width = wl_shm_buffer_get_width(shm);
+            surface->height = wl_shm_buffer_get_height(shm);
+            uint64_t hash = checksum_buffer(shm);
+            compositor->checksum =
+                (compositor->checksum ^ hash) * 0x100000001b3ULL;
+            if (compositor->options.verbose) {
+                printf("frame %llu: %dx%d %016llx\n",
+                        (unsigned long long)compositor->frame,
+                        surface->width, surface->height,
+                        (unsigned long long)hash);
+            }
+            if (surface->xdg_toplevel != NULL) {
+                compositor->focus = surface;
+            }
+        } else if (buffer != NULL) {
+            wl_resource_post_error(buffer, 0, "only wl_shm buffers work here");
+            return;
+        }
+    }
+
+    wl_list_insert_list(surface->frames.prev, &surface->pending_frames);
+    wl_list_init(&surface->pending_frames);
+    /* Whatever was committed before and not shown yet never will be */
+    discard_feedback(&surface->feedback);
+    wl_list_insert_list(&surface->feedback, &surface->pending_feedback);
+    wl_list_init(&surface->pending_feedback);
+    ++compositor->commits;
+    compositor->committed = true;
+
+    if (surface->xdg_toplevel != NULL && !surface->configured) {
+        send_configure(compositor, surface);
+    }
+}
+
+static void
+surface_set_buffer_transform(struct wl_client *client,
+        struct wl_resource *resource, int32_t transform)
+{
+}
+
+static void
+surface_set_buffer_scale(struct wl_client *client,
+        struct wl_resource *resource, int32_t scale)
+{
+}
+
+static void
+surface_offset(struct wl_client *client, struct wl_resource *resource,
+        int32_t x, int32_t y)
+{
+}
+
+static const struct wl_surface_interface surface_impl = {
+    .destroy = destroy_resource,
+    .attach = surface_attach,
+    .damage = surface_damage,
+    .frame = surface_frame,
+    .set_opaque_region = surface_set_region,
+    .set_input_region = surface_set_region,
+    .commit = surface_commit,
+    .set_buffer_transform = surface_set_buffer_transform,
+    .set_buffer_scale = surface_set_buffer_scale,
+    .damage_buffer = surface_damage,
+    .offset = surface_offset,
+};
+
+static void
+surface_destroy(struct wl_resource *resource)
+{
+    struct surface *surface = wl_resource_get_user_data(resource);
+    struct compositor *compositor = surface->compositor;
+    if (compositor->focus == surface) {
+        compositor->focus = NULL;
+        compositor->pointer_entered = false;
+        compositor->keyboard_entered = false;
+    }
+    if (surface->xdg_surface != NULL) {
+        wl_resource_set_user_data(surface->xdg_surface, NULL);
+    }
+    if (surface->xdg_toplevel != NULL) {
+        wl_resource_set_user_data(surface->xdg_toplevel, NULL);
+    }
+    destroy_resource_list(&surface->pending_frames);
+    destroy_resource_list(&surface->frames);
+    discard_feedback(&surface->pending_feedback);
+    discard_feedback(&surface->feedback);
+    wl_list_remove(&surface->pending_buffer_destroy.link);
+    wl_list_remove(&surface->buffer_destroy.link);
+    wl_list_remove(&surface->link);
+    free(surface);
+}
+
+static void
+region_add(struct wl_client *client, struct wl_resource *resource,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static const struct wl_region_interface region_impl = {
+    .destroy = destroy_resource,
+    .add = region_add,
+    .subtract = region_add,
+};
+
+static void
+compositor_create_surface(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct compositor *compositor = wl_resource_get_user_data(resource);
+    struct surface *surface = calloc(1, sizeof(*surface));
+    if (surface == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    surface->resource = wl_resource_create(client, &wl_surface_interface,
+            wl_resource_get_version(resource), id);
+    if (surface->resource == NULL) {
+        free(surface);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    surface->compositor = compositor;
+    wl_list_init(&surface->pending_frames);
+    wl_list_init(&surface->frames);
+    wl_list_init(&surface->pending_feedback);
+    wl_list_init(&surface->feedback);
+    surface->pending_buffer_destroy.notify = handle_pending_buffer_destroy;
+    wl_list_init(&surface->pending_buffer_destroy.link);
+    surface->buffer_destroy.notify = handle_buffer_destroy;
+    wl_list_init(&surface->buffer_destroy.link);
+    wl_list_insert(&compositor->surfaces, &surface->link);
+    wl_resource_set_implementation(surface->resource, &surface_impl,
+            surface, surface_destroy);
+}
+
+static void
+compositor_create_region(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *region = wl_resource_create(client,
+            &wl_region_interface, 1, id);
+    if (region == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(region, &region_impl, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_impl = {
+    .create_surface = compositor_create_surface,
+    .create_region = compositor_create_region,
+};
+
+static void
+bind_compositor(struct wl_client *client, void *data, uint32_t version,
+        uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &wl_compositor_interface, version, id);
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &compositor_impl, data, NULL);
+}
+
+static void
+presentation_feedback(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *surface_resource, uint32_t id)
+{
+    struct surface *surface = wl_resource_get_user_data(surface_resource);
+    struct wl_resource *feedback = wl_resource_create(client,
+            &wp_presentation_feedback_interface, 1, id);
+    if (feedback == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(feedback, NULL, NULL, unlink_resource);
+    wl_list_insert(surface->pending_feedback.prev,
+            wl_resource_get_link(feedback));
+}
+
+static const struct wp_presentation_interface presentation_impl = {
+    .destroy = destroy_resource,
+    .feedback = presentation_feedback,
+};
+
+static void
+bind_presentation(struct wl_client *client, void *data, uint32_t version,
+        uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &wp_presentation_interface, version, id);
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &presentation_impl, data, NULL);
+    wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+static void
+toplevel_set_parent(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *parent)
+{
+}
+
+static void
+toplevel_set_string(struct wl_client *client, struct wl_resource *resource,
+        const char *string)
+{
+}
+
+static void
+toplevel_show_window_menu(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *seat,
+        uint32_t serial, int32_t x, int32_t y)
+{
+}
+
+static void
+toplevel_move(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *seat, uint32_t serial)
+{
+}
+
+static void
+toplevel_resize(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *seat, uint32_t serial, uint32_t edges)
+{
+}
+
+static void
+toplevel_set_size(struct wl_client *client, struct wl_resource *resource,
+        int32_t width, int32_t height)
+{
+}
+
+static void
+toplevel_set_state(struct wl_client *client, struct wl_resource *resource)
+{
+}
+
+static void
+toplevel_set_fullscreen(struct wl_client *client,
+        struct wl_resource *resource, struct wl_resource *output)
+{
+}
+
+static const struct xdg_toplevel_interface toplevel_impl = {
+    .destroy = destroy_resource,
+    .set_parent = toplevel_set_parent,
+    .set_title = toplevel_set_string,
+    .set_app_id = toplevel_set_string,
+    .show_window_menu = toplevel_show_window_menu,
+    .move = toplevel_move,
+    .resize = toplevel_resize,
+    .set_max_size = toplevel_set_size,
+    .set_min_size = toplevel_set_size,
+    .set_maximized = toplevel_set_state,
+    .unset_maximized = toplevel_set_state,
+    .set_fullscreen = toplevel_set_fullscreen,
+    .unset_fullscreen = toplevel_set_state,
+    .set_minimized = toplevel_set_state,
+};
+
+static void
+toplevel_destroy(struct wl_resource *resource)
+{
+    struct surface *surface = wl_resource_get_user_data(resource);
+    if (surface != NULL) {
+        surface->xdg_toplevel = NULL;
+        if (surface->compositor->focus == surface) {
+            surface->compositor->focus = NULL;
+            surface->compositor->pointer_entered = false;
+            surface->compositor->keyboard_entered = false;
+        }
+    }
+}
+
+static void
+popup_grab(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *seat, uint32_t serial)
+{
+}
+
+static void
+popup_reposition(struct wl_client *client, struct wl_resource *resource,
+        struct wl_resource *positioner, uint32_t token)
+{
+}
+
+static const struct xdg_popup_interface popup_impl = {
+    .destroy = destroy_resource,
+    .grab = popup_grab,
+    .reposition = popup_reposition,
+};
+
+static void
+xdg_surface_get_toplevel(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct surface *surface = wl_resource_get_user_data(resource);
+    struct wl_resource *toplevel = wl_resource_create(client,
+            &xdg_toplevel_interface, wl_resource_get_version(resource), id);
+    if (toplevel == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(toplevel, &toplevel_impl, surface,
+            toplevel_destroy);
+    if (surface != NULL) {
+        surface->xdg_toplevel = toplevel;
+    }
+}
+
+static void
+xdg_surface_get_popup(struct wl_client *client, struct wl_resource *resource,
+        uint32_t id, struct wl_resource *parent,
+        struct wl_resource *positioner)
+{
+    /* Nothing to show it on: dismiss it right away */
+    struct wl_resource *popup = wl_resource_create(client,
+            &xdg_popup_interface, wl_resource_get_version(resource), id);
+    if (popup == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(popup, &popup_impl, NULL, NULL);
+    xdg_popup_send_popup_done(popup);
+}
+
+static void
+xdg_surface_set_window_geometry(struct wl_client *client,
+        struct wl_resource *resource,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void
+xdg_surface_ack_configure(struct wl_client *client,
+        struct wl_resource *resource, uint32_t serial)
+{
+}
+
+static const struct xdg_surface_interface xdg_surface_impl = {
+    .destroy = destroy_resource,
+    .get_toplevel = xdg_surface_get_toplevel,
+    .get_popup = xdg_surface_get_popup,
+    .set_window_geometry = xdg_surface_set_window_geometry,
+    .ack_configure = xdg_surface_ack_configure,
+};
+
+static void
+xdg_surface_destroy(struct wl_resource *resource)
+{
+    struct surface *surface = wl_resource_get_user_data(resource);
+    if (surface != NULL) {
+        surface->xdg_surface = NULL;
+    }
+}
+
+static void
+positioner_set_int2(struct wl_client *client, struct wl_resource *resource,
+        int32_t a, int32_t b)
+{
+}
+
+static void
+positioner_set_rect(struct wl_client *client, struct wl_resource *resource,
+        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void
+positioner_set_uint(struct wl_client *client, struct wl_resource *resource,
+        uint32_t value)
+{
+}
+
+static void
+positioner_set_reactive(struct wl_client *client,
+        struct wl_resource *resource)
+{
+}
+
+static const struct xdg_positioner_interface positioner_impl = {
+    .destroy = destroy_resource,
+    .set_size = positioner_set_int2,
+    .set_anchor_rect = positioner_set_rect,
+    .set_anchor = positioner_set_uint,
+    .set_gravity = positioner_set_uint,
+    .set_constraint_adjustment = positioner_set_uint,
+    .set_offset = positioner_set_int2,
+    .set_reactive = positioner_set_reactive,
+    .set_parent_size = positioner_set_int2,
+    .set_parent_configure = positioner_set_uint,
+};
+
+static void
+wm_base_create_positioner(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id)
+{
+    struct wl_resource *positioner = wl_resource_create(client,
+            &xdg_positioner_interface, wl_resource_get_version(resource), id);
+    if (positioner == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(positioner, &positioner_impl, NULL, NULL);
+}
+
+static void
+wm_base_get_xdg_surface(struct wl_client *client,
+        struct wl_resource *resource, uint32_t id,
+        struct wl_resource *surface_resource)
+{
+    struct surface *surface = wl_resource_get_user_data(surface_resource);
+    if (surface->xdg_surface != NULL) {
+        wl_resource_post_error(resource, XDG_WM_BASE_ERROR_ROLE,
+                "surface already has a role");
+        return;
+    }
+    struct wl_resource *xdg_surface = wl_resource_create(client,
+            &xdg_surface_interface, wl_resource_get_version(resource), id);
+    if (xdg_surface == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(xdg_surface, &xdg_surface_impl, surface,
+            xdg_surface_destroy);
+    surface->xdg_surface = xdg_surface;
+}
+
+static void
+wm_base_pong(struct wl_client *client, struct wl_resource *resource,
+        uint32_t serial)
+{
+}
+
+static const struct xdg_wm_base_interface wm_base_impl = {
+    .destroy = destroy_resource,
+    .create_positioner = wm_base_create_positioner,
+    .get_xdg_surface = wm_base_get_xdg_surface,
+    .pong = wm_base_pong,
+};
+
+static void
+bind_wm_base(struct wl_client *client, void *data, uint32_t version,
+        uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &xdg_wm_base_interface, version, id);
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &wm_base_impl, data, NULL);
+}
+
+static void
+pointer_set_cursor(struct wl_client *client, struct wl_resource *resource,
+        uint32_t serial, struct wl_resource *surface,
+        int32_t hotspot_x, int32_t hotspot_y)
+{
+}
+
+static const struct wl_pointer_interface pointer_impl = {
+    .set_cursor = pointer_set_cursor,
+    .release = destroy_resource,
+};
+
+static const struct wl_keyboard_interface keyboard_impl = {
+    .release = destroy_resource,
+};
+
+static const struct wl_touch_interface touch_impl = {
+    .release = destroy_resource,
+};
+
+static struct wl_resource *
+create_device(struct wl_client *client, struct wl_resource *seat,
+        const struct wl_interface *interface, const void *impl,
+        struct wl_list *list, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client, interface,
+            wl_resource_get_version(seat), id);
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return NULL;
+    }
+    wl_resource_set_implementation(resource, impl,
+            wl_resource_get_user_data(seat), unlink_resource);
+    wl_list_insert(list, wl_resource_get_link(resource));
+    return resource;
+}
+
+static void
+seat_get_pointer(struct wl_client *client, struct wl_resource *resource,
+        uint32_t id)
+{
+    struct compositor *compositor = wl_resource_get_user_data(resource);
+    create_device(client, resource, &wl_pointer_interface, &pointer_impl,
+            &compositor->pointers, id);
+    compositor->pointer_entered = false;
+}
+
+static void
+seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
+        uint32_t id)
+{
+    struct compositor *compositor = wl_resource_get_user_data(resource);
+    struct wl_resource *keyboard = create_device(client, resource,
+            &wl_keyboard_interface, &keyboard_impl, &compositor->keyboards, id);
+    if (keyboard == NULL) {
+        return;
+    }
+    wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+            compositor->keymap_fd, sizeof(keymap_text));
+    if (wl_resource_get_version(keyboard)
+            >= WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION) {
+        wl_keyboard_send_repeat_info(keyboard, 25, 600);
+    }
+    compositor->keyboard_entered = false;
+}
+
+static void
+seat_get_touch(struct wl_client *client, struct wl_resource *resource,
+        uint32_t id)
+{
+    struct compositor *compositor = wl_resource_get_user_data(resource);
+    create_device(client, resource, &wl_touch_interface, &touch_impl,
+            &compositor->touches, id);
+}
+
+static const struct wl_seat_interface seat_impl = {
+    .get_pointer = seat_get_pointer,
+    .get_keyboard = seat_get_keyboard,
+    .get_touch = seat_get_touch,
+    .release = destroy_resource,
+};
+
+static void
+bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+    struct wl_resource *resource = wl_resource_create(client,
+            &wl_seat_interface, version, id);
+    if (resource == NULL) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &seat_impl, data, NULL);
+    wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_POINTER
+            | WL_SEAT_CAPABILITY_KEYBOARD | WL_SEAT_CAPABILITY_TOUCH);
+    if (version >= WL_SEAT_NAME_SINCE_VERSION) {
+        wl_seat_send_name(resource, "headless");
+    }
+}
+
+static void
+send_pointer_frame(struct wl_resource *pointer)
+{
+    if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION) {
+        wl_pointer_send_frame(pointer);
+    }
+}
+
+static void
+send_touch_frame(struct wl_list *touches)
+{
+    struct wl_resource *touch;
+    wl_resource_for_each(touch, touches) {
+        wl_touch_send_frame(touch);
+    }
+}
+
+/* A Lissajous curve over the surface, one point per event */
+static void
+pointer_position(struct compositor *compositor, uint32_t n,
+        wl_fixed_t *x, wl_fixed_t *y)
+{
+    struct surface *focus = compositor->focus;
+    double t = n * 0.01;
+    *x = wl_fixed_from_double(focus->width * (0.5 + 0.45 * sin(3 * t)));
+    *y = wl_fixed_from_double(focus->height * (0.5 + 0.45 * sin(2 * t)));
+}
+
+static void
+inject_pointer(struct compositor *compositor, uint64_t ns)
+{
+    struct surface *focus = compositor->focus;
+    struct wl_resource *pointer;
+    wl_fixed_t x, y;
+    pointer_position(compositor, compositor->pointer_events++, &x, &y);
+
+    if (!compositor->pointer_entered) {
+        uint32_t serial = wl_display_next_serial(compositor->display);
+        wl_resource_for_each(pointer, &compositor->pointers) {
+            wl_pointer_send_enter(pointer, serial, focus->resource, x, y);
+            send_pointer_frame(pointer);
+        }
+        compositor->pointer_entered = true;
+        return;
+    }
+    wl_resource_for_each(pointer, &compositor->pointers) {
+        wl_pointer_send_motion(pointer, vclock_ms(ns), x, y);
+        send_pointer_frame(pointer);
+    }
+}
+
+static void
+inject_key(struct compositor *compositor, uint64_t ns)
+{
+    struct wl_resource *keyboard;
+    if (!compositor->keyboard_entered) {
+        struct wl_array keys;
+        wl_array_init(&keys);
+        uint32_t serial = wl_display_next_serial(compositor->display);
+        wl_resource_for_each(keyboard, &compositor->keyboards) {
+            wl_keyboard_send_enter(keyboard, serial,
+                    compositor->focus->resource, &keys);
+            wl_keyboard_send_modifiers(keyboard, serial, 0, 0, 0, 0);
+        }
+        wl_array_release(&keys);
+        compositor->keyboard_entered = true;
+    }
+
+    /* Every other event releases the key the one before pressed */
+    uint32_t n = compositor->key_events++;
+    uint32_t key = typed_keys[(n / 2) % (sizeof(typed_keys) / sizeof(*typed_keys))];
+    uint32_t state = n % 2 == 0 ?
+        WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED;
+    uint32_t serial = wl_display_next_serial(compositor->display);
+    wl_resource_for_each(keyboard, &compositor->keyboards) {
+        wl_keyboard_send_key(keyboard, serial, vclock_ms(ns), key, state);
+    }
+}
+
+/*
+ * Where finger is during a stroke: one finger follows the stroke, more
+ * sit on a circle about it that widens and turns a quarter as it goes,
+ * so they pan, pinch and rotate at once.
+ */
+static void
+finger_position(struct compositor *compositor, uint32_t n, uint32_t step,
+        int finger, wl_fixed_t *x, wl_fixed_t *y)
+{
+    pointer_position(compositor, n * 7, x, y);
+    int fingers = compositor->options.touch_fingers;
+    if (fingers == 1) {
+        return;
+    }
+    double t = (double)step / (TOUCH_STROKE_MOTIONS + 1);
+    double radius = 40 + 60 * t;
+    double angle = 2 * M_PI * finger / fingers + M_PI / 2 * t;
+    *x += wl_fixed_from_double(radius * cos(angle));
+    *y += wl_fixed_from_double(radius * sin(angle));
+}
+
+/* A stroke that never moves, to be lifted after touch_hold_ms */
+static void
+inject_hold(struct compositor *compositor, uint64_t ns)
+{
+    bool held = compositor->touch_held;
+    if (held && ns - compositor->touch_down_ns
+            < compositor->options.touch_hold_ms * 1000000ULL) {
+        return;
+    }
+    struct wl_resource *touch;
+    uint32_t n = compositor->touch_events++;
+    uint32_t serial = wl_display_next_serial(compositor->display);
+
+    for (int finger = 0; finger < compositor->options.touch_fingers;
+            ++finger) {
+        wl_fixed_t x, y;
+        finger_position(compositor, n, 0, finger, &x, &y);
+        wl_resource_for_each(touch, &compositor->touches) {
+            if (!held) {
+                wl_touch_send_down(touch, serial, vclock_ms(ns),
+                        compositor->focus->resource, finger, x, y);
+            } else {
+                wl_touch_send_up(touch, serial, vclock_ms(ns), finger);
+            }
+        }
+    }
+    send_touch_frame(&compositor->touches);
+    compositor->touch_held = !held;
+    compositor->touch_down_ns = ns;
+}
+
+static void
+inject_touch(struct compositor *compositor, uint64_t ns)
+{
+    if (compositor->options.touch_hold_ms > 0) {
+        inject_hold(compositor, ns);
+        return;
+    }
+    struct wl_resource *touch;
+    uint32_t n = compositor->touch_events++;
+    uint32_t step = n % (TOUCH_STROKE_MOTIONS + 2);
+    uint32_t serial = wl_display_next_serial(compositor->display);
+
+    for (int finger = 0; finger < compositor->options.touch_fingers;
+            ++finger) {
+        wl_fixed_t x, y;
+        finger_position(compositor, n, step, finger, &x, &y);
+        wl_resource_for_each(touch, &compositor->touches) {
+            if (step == 0) {
+                wl_touch_send_down(touch, serial, vclock_ms(ns),
+                        compositor->focus->resource, finger, x, y);
+            } else if (step == TOUCH_STROKE_MOTIONS + 1) {
+                wl_touch_send_up(touch, serial, vclock_ms(ns), finger);
+            } else {
+                wl_touch_send_motion(touch, vclock_ms(ns), finger, x, y);
+            }
+        }
+    }
+    send_touch_frame(&compositor->touches);
+}
+
+/* Sends every event of a rate_hz stream due by now, on the virtual clock */
+static void
+inject_due(struct compositor *compositor, int rate_hz, uint64_t *next_ns,
+        void (*inject)(struct compositor *compositor, uint64_t ns))
+{
+    if (rate_hz <= 0) {
+        return;
+    }
+    uint64_t interval = 1000000000ULL / rate_hz;
+    for (; *next_ns <= compositor->vclock_ns; *next_ns += interval) {
+        inject(compositor, *next_ns);
+    }
+}
+
+static void
+vblank(struct compositor *compositor)
+{
+    struct options *options = &compositor->options;
+    compositor->vclock_ns += compositor->period_ns;
+    compositor->committed = false;
+
+    uint64_t now = wall_ns();
+    uint64_t seq = compositor->frame + 1;
+    struct surface *surface;
+    wl_list_for_each(surface, &compositor->surfaces, link) {
+        struct wl_resource *feedback, *tmp;
+        wl_resource_for_each_safe(feedback, tmp, &surface->feedback) {
+            wp_presentation_feedback_send_presented(feedback,
+                    (now / 1000000000) >> 32, now / 1000000000,
+                    now % 1000000000, compositor->period_ns,
+                    seq >> 32, seq, WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+            wl_resource_destroy(feedback);
+        }
+
+        struct wl_resource *callback;
+        wl_resource_for_each_safe(callback, tmp, &surface->frames) {
+            wl_callback_send_done(callback, vclock_ms(compositor->vclock_ns));
+            wl_resource_destroy(callback);
+        }
+    }
+
+    if (compositor->focus != NULL && !compositor->closing) {
+        inject_due(compositor, options->pointer_hz,
+                &compositor->next_pointer_ns, inject_pointer);
+        inject_due(compositor, options->key_hz,
+                &compositor->next_key_ns, inject_key);
+        inject_due(compositor, options->touch_hz,
+                &compositor->next_touch_ns, inject_touch);
+    }
+
+    ++compositor->frame;
+    if (options->resize_every > 0 && options->nsizes > 1
+            && compositor->frame % options->resize_every == 0) {
+        compositor->size_index = (compositor->size_index + 1) % options->nsizes;
+        wl_list_for_each(surface, &compositor->surfaces, link) {
+            if (surface->xdg_toplevel != NULL) {
+                send_configure(compositor, surface);
+            }
+        }
+    }
+
+    if (compositor->frame == options->frames) {
+        wl_list_for_each(surface, &compositor->surfaces, link) {
+            if (surface->xdg_toplevel != NULL) {
+                xdg_toplevel_send_close(surface->xdg_toplevel);
+            }
+        }
+        compositor->closing = true;
+        compositor->close_wall_ns = wall_ns();
+    }
+}
+
+static void
+handle_client_destroy(struct wl_listener *listener, void *data)
+{
+    struct compositor *compositor =
+        wl_container_of(listener, compositor, client_destroy);
+    compositor->client = NULL;
+}
+
+static int
+create_keymap(void)
+{
+    int fd = memfd_create("keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0) {
+        return -1;
+    }
+    if (write(fd, keymap_text, sizeof(keymap_text)) != sizeof(keymap_text)) {
+        close(fd);
+        return -1;
+    }
+    /* Clients map it MAP_PRIVATE from version 7 on; nobody may change it */
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE
+            | F_SEAL_SEAL);
+    return fd;
+}
+
+static pid_t
+spawn_client(char *argv[], int fd)
+{
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+    /* The child keeps a copy without FD_CLOEXEC */
+    int client_fd = dup(fd);
+    char value[16];
+    snprintf(value, sizeof(value), "%d", client_fd);
+    setenv("WAYLAND_SOCKET", value, 1);
+    execvp(argv[0], argv);
+    perror(argv[0]);
+    _exit(127);
+}
+
+static bool
+parse_sizes(struct options *options, char *arg)
+{
+    for (char *tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        int width, height;
+        if (options->nsizes == MAX_SIZES
+                || sscanf(tok, "%dx%d", &width, &height) != 2
+                || width < 0 || height < 0) {
+            return false;
+        }
+        options->sizes[options->nsizes].width = width;
+        options->sizes[options->nsizes].height = height;
+        ++options->nsizes;
+    }
+    return true;
+}
+
+static void
+usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [options] [--] CLIENT [ARGS...]\n"
+        "  -n FRAMES        close the client after this many frames (600)\n"
+        "  -r HZ            virtual refresh rate (60)\n"
+        "  -R               pace vblanks on the wall clock\n"
+        "  -s WxH[,WxH...]  configure sizes, the first one initially\n"
+        "  -S FRAMES        frames between switching to the next size\n"
+        "  -p HZ            pointer motion events per virtual second\n"
+        "  -k HZ            key presses and releases per virtual second\n"
+        "  -t HZ            touch events per virtual second\n"
+        "  -f FINGERS       contacts per touch stroke (1)\n"
+        "  -H MS            hold each stroke still for MS, then lift it\n"
+        "  -v               print the checksum of every buffer\n",
+        name);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct compositor compositor = {
+        .options = {
+            .frames = 600,
+            .refresh_hz = 60,
+            .touch_fingers = 1,
+        },
+        .keymap_fd = -1,
+    };
+    struct options *options = &compositor.options;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:r:Rs:S:p:k:t:f:H:v")) != -1) {
+        switch (opt) {
+        case 'n':
+            options->frames = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            options->refresh_hz = atoi(optarg);
+            break;
+        case 'R':
+            options->realtime = true;
+            break;
+        case 's':
+            if (!parse_sizes(options, optarg)) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'S':
+            options->resize_every = strtoull(optarg, NULL, 10);
+            break;
+        case 'p':
+            options->pointer_hz = atoi(optarg);
+            break;
+        case 'k':
+            options->key_hz = atoi(optarg);
+            break;
+        case 't':
+            options->touch_hz = atoi(optarg);
+            break;
+        case 'f':
+            options->touch_fingers = atoi(optarg);
+            break;
+        case 'H':
+            options->touch_hold_ms = atoi(optarg);
+            break;
+        case 'v':
+            options->verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind == argc || options->refresh_hz <= 0
+            || options->touch_fingers <= 0 || options->touch_hold_ms < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    compositor.period_ns = 1000000000ULL / options->refresh_hz;
+
+    compositor.keymap_fd = create_keymap();
+    int fds[2];
+    if (compositor.keymap_fd < 0
+            || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        perror("headless_compositor");
+        return 1;
+    }
+
+    compositor.display = wl_display_create();
+    compositor.loop = wl_display_get_event_loop(compositor.display);
+    wl_list_init(&compositor.surfaces);
+    wl_list_init(&compositor.pointers);
+    wl_list_init(&compositor.keyboards);
+    wl_list_init(&compositor.touches);
+    wl_display_init_shm(compositor.display);
+    wl_global_create(compositor.display, &wl_compositor_interface, 4,
+            &compositor, bind_compositor);
+    wl_global_create(compositor.display, &xdg_wm_base_interface, 4,
+            &compositor, bind_wm_base);
+    wl_global_create(compositor.display, &wl_seat_interface, 7,
+            &compositor, bind_seat);
+    wl_global_create(compositor.display, &wp_presentation_interface, 1,
+            &compositor, bind_presentation);
+
+    compositor.child = spawn_client(&argv[optind], fds[1]);
+    close(fds[1]);
+    if (compositor.child < 0) {
+        perror("fork");
+        return 1;
+    }
+    compositor.client = wl_client_create(compositor.display, fds[0]);
+    compositor.client_destroy.notify = handle_client_destroy;
+    wl_client_add_destroy_listener(compositor.client,
+            &compositor.client_destroy);
+
+    uint64_t start_ns = wall_ns();
+    uint64_t last_vblank_ns = start_ns;
+    while (compositor.client != NULL) {
+        wl_display_flush_clients(compositor.display);
+
+        uint64_t now = wall_ns();
+        int timeout;
+        if (options->realtime) {
+            uint64_t due = last_vblank_ns + compositor.period_ns;
+            timeout = due > now ? (due - now + 999999) / 1000000 : 0;
+        } else {
+            timeout = compositor.committed ? 0 : STALL_TIMEOUT_MS;
+        }
+        if (wl_event_loop_dispatch(compositor.loop, timeout) < 0
+                && errno != EINTR) {
+            break;
+        }
+        if (compositor.client == NULL) {
+            break;
+        }
+
+        now = wall_ns();
+        bool due = options->realtime ?
+            now >= last_vblank_ns + compositor.period_ns :
+            compositor.committed || now >= last_vblank_ns
+                    + STALL_TIMEOUT_MS * 1000000ULL;
+        if (due) {
+            vblank(&compositor);
+            last_vblank_ns = now;
+        }
+
+        if (compositor.closing && now >= compositor.close_wall_ns
+                + CLOSE_TIMEOUT_MS * 1000000ULL) {
+            fprintf(stderr, "client did not exit after close, killing it\n");
+            kill(compositor.child, SIGTERM);
+            break;
+        }
+    }
+    uint64_t elapsed_ns = wall_ns() - start_ns;
+
+    int status = 0;
+    waitpid(compositor.child, &status, 0);
+    if (compositor.client != NULL) {
+        wl_client_destroy(compositor.client);
+    }
+
+    printf("frames %llu, commits %llu, virtual %.3f s, wall %.3f s, "
+            "%.1f frames/s\n",
+            (unsigned long long)compositor.frame,
+            (unsigned long long)compositor.commits,
+            compositor.vclock_ns / 1e9, elapsed_ns / 1e9,
+            compositor.frame / (elapsed_ns / 1e9));
+    printf("input: %u pointer, %u key, %u touch events\n",
+            compositor.pointer_events, compositor.key_events,
+            compositor.touch_events);
+    printf("checksum %016llx\n", (unsigned long long)compositor.checksum);
+
+    wl_display_destroy(compositor.display);
+    close(compositor.keymap_fd);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
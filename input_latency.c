@@ -0,0 +1,169 @@
+#include <string.h>
+#include "input_latency.h"
+
+/* A compositor timestamp older than this is not in our clock */
+#define MAX_TIMESTAMP_AGE_NS 1000000000ULL
+
+static const char *const type_names[INPUT_LATENCY_COUNT] = {
+    [INPUT_LATENCY_MOTION] = "motion",
+    [INPUT_LATENCY_BUTTON] = "button",
+    [INPUT_LATENCY_AXIS] = "axis",
+    [INPUT_LATENCY_TOUCH] = "touch",
+    [INPUT_LATENCY_KEY] = "key",
+};
+
+static const enum input_latency_device type_devices[INPUT_LATENCY_COUNT] = {
+    [INPUT_LATENCY_MOTION] = INPUT_LATENCY_POINTER,
+    [INPUT_LATENCY_BUTTON] = INPUT_LATENCY_POINTER,
+    [INPUT_LATENCY_AXIS] = INPUT_LATENCY_POINTER,
+    [INPUT_LATENCY_TOUCH] = INPUT_LATENCY_TOUCHSCREEN,
+    [INPUT_LATENCY_KEY] = INPUT_LATENCY_KEYBOARD,
+};
+
+void
+input_latency_init(struct input_latency *latency)
+{
+    memset(latency, 0, sizeof(*latency));
+    for (int i = 0; i < INPUT_LATENCY_DEVICE_COUNT; ++i) {
+        latency->devices[i].latency = latency;
+    }
+}
+
+void
+input_latency_finish(struct input_latency *latency)
+{
+    for (int i = 0; i < INPUT_LATENCY_DEVICE_COUNT; ++i) {
+        input_latency_stop(latency, i);
+    }
+    if (latency->manager != NULL) {
+        zwp_input_timestamps_manager_v1_destroy(latency->manager);
+        latency->manager = NULL;
+    }
+}
+
+void
+input_latency_set_manager(struct input_latency *latency,
+        struct zwp_input_timestamps_manager_v1 *manager)
+{
+    latency->manager = manager;
+}
+
+static void
+timestamps_timestamp(void *data, struct zwp_input_timestamps_v1 *timestamps,
+        uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec)
+{
+    struct input_latency_timestamps *device = data;
+    device->next_ns = ((uint64_t)tv_sec_hi << 32 | tv_sec_lo) * 1000000000ULL
+        + tv_nsec;
+}
+
+static const struct zwp_input_timestamps_v1_listener timestamps_listener = {
+    .timestamp = timestamps_timestamp,
+};
+
+void
+input_latency_start(struct input_latency *latency,
+        enum input_latency_device device, void *proxy)
+{
+    struct input_latency_timestamps *slot = &latency->devices[device];
+    if (latency->manager == NULL || slot->timestamps != NULL) {
+        return;
+    }
+    switch (device) {
+    case INPUT_LATENCY_POINTER:
+        slot->timestamps =
+            zwp_input_timestamps_manager_v1_get_pointer_timestamps(
+                    latency->manager, proxy);
+        break;
+    case INPUT_LATENCY_KEYBOARD:
+        slot->timestamps =
+            zwp_input_timestamps_manager_v1_get_keyboard_timestamps(
+                    latency->manager, proxy);
+        break;
+    case INPUT_LATENCY_TOUCHSCREEN:
+        slot->timestamps =
+            zwp_input_timestamps_manager_v1_get_touch_timestamps(
+                    latency->manager, proxy);
+        break;
+    default:
+        return;
+    }
+    zwp_input_timestamps_v1_add_listener(slot->timestamps,
+            &timestamps_listener, slot);
+}
+
+void
+input_latency_stop(struct input_latency *latency,
+        enum input_latency_device device)
+{
+    struct input_latency_timestamps *slot = &latency->devices[device];
+    if (slot->timestamps != NULL) {
+        zwp_input_timestamps_v1_destroy(slot->timestamps);
+        slot->timestamps = NULL;
+    }
+    slot->next_ns = 0;
+}
+
+void
+input_latency_mark(struct input_latency *latency,
+        enum input_latency_type type)
+{
+    struct input_latency_timestamps *device =
+        &latency->devices[type_devices[type]];
+    uint64_t now = frame_stats_now();
+    uint64_t ns = now;
+    if (device->next_ns != 0 && device->next_ns <= now
+            && now - device->next_ns < MAX_TIMESTAMP_AGE_NS) {
+        ns = device->next_ns;
+    }
+    device->next_ns = 0;
+
+    /* The frame waits on its oldest event */
+    if (latency->pending.ns[type] == 0) {
+        latency->pending.ns[type] = ns;
+    }
+}
+
+void
+input_latency_take(struct input_latency *latency, struct input_tag *tag)
+{
+    *tag = latency->pending;
+    memset(&latency->pending, 0, sizeof(latency->pending));
+}
+
+void
+input_latency_restore(struct input_latency *latency,
+        const struct input_tag *tag)
+{
+    for (int i = 0; i < INPUT_LATENCY_COUNT; ++i) {
+        uint64_t ns = tag->ns[i];
+        if (ns != 0 && (latency->pending.ns[i] == 0
+                    || ns < latency->pending.ns[i])) {
+            latency->pending.ns[i] = ns;
+        }
+    }
+}
+
+void
+input_latency_commit(struct input_latency *latency, struct input_tag *tag,
+        uint64_t commit_ns)
+{
+    for (int i = 0; i < INPUT_LATENCY_COUNT; ++i) {
+        if (tag->ns[i] != 0 && commit_ns >= tag->ns[i]) {
+            frame_histogram_record(&latency->histograms[i],
+                    commit_ns - tag->ns[i]);
+        }
+        tag->ns[i] = 0;
+    }
+}
+
+void
+input_latency_report(const struct input_latency *latency, FILE *out)
+{
+    fprintf(out, "input to commit, us (%s):\n", latency->manager != NULL ?
+            "from compositor timestamps" : "from arrival");
+    fprintf(out, FRAME_HISTOGRAM_HEADER, "input");
+    for (int i = 0; i < INPUT_LATENCY_COUNT; ++i) {
+        frame_histogram_report(&latency->histograms[i], type_names[i], out);
+    }
+}
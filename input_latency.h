@@ -0,0 +1,92 @@
+#ifndef INPUT_LATENCY_H
+#define INPUT_LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-client.h>
+#include "frame_stats.h"
+#include "input-timestamps-unstable-v1-client-protocol.h"
+
+enum input_latency_type {
+    INPUT_LATENCY_MOTION,
+    INPUT_LATENCY_BUTTON,
+    INPUT_LATENCY_AXIS,
+    INPUT_LATENCY_TOUCH,
+    INPUT_LATENCY_KEY,
+    INPUT_LATENCY_COUNT,
+};
+
+enum input_latency_device {
+    INPUT_LATENCY_POINTER,
+    INPUT_LATENCY_KEYBOARD,
+    INPUT_LATENCY_TOUCHSCREEN,
+    INPUT_LATENCY_DEVICE_COUNT,
+};
+
+/*
+ * The causal tag a frame carries: per input type, when the oldest event
+ * the frame is the first to reflect came in, CLOCK_MONOTONIC ns, 0 if
+ * none did.
+ */
+struct input_tag {
+    uint64_t ns[INPUT_LATENCY_COUNT];
+};
+
+struct input_latency;
+
+struct input_latency_timestamps {
+    struct input_latency *latency;
+    struct zwp_input_timestamps_v1 *timestamps;
+    /* From the timestamp event, for the input event right behind it */
+    uint64_t next_ns;
+};
+
+/*
+ * Measures input-to-commit latency: input handlers stamp events as they
+ * arrive, a frame takes the stamps when it is planned, and committing it
+ * records the time since each into a histogram for the input type.
+ *
+ * With zwp_input_timestamps_v1 the stamp is the compositor's nanosecond
+ * time for the event instead of its arrival, so the time the event spent
+ * on its way to us counts too.
+ */
+struct input_latency {
+    struct input_tag pending;
+    struct zwp_input_timestamps_manager_v1 *manager;
+    struct input_latency_timestamps devices[INPUT_LATENCY_DEVICE_COUNT];
+    struct frame_histogram histograms[INPUT_LATENCY_COUNT];
+};
+
+void input_latency_init(struct input_latency *latency);
+/* Destroys the timestamp subscriptions and the manager */
+void input_latency_finish(struct input_latency *latency);
+
+/* Takes ownership of the bound global */
+void input_latency_set_manager(struct input_latency *latency,
+        struct zwp_input_timestamps_manager_v1 *manager);
+
+/*
+ * Subscribes to timestamps for a device, if the manager is bound; proxy is
+ * its wl_pointer, wl_keyboard or wl_touch. Stop before releasing it.
+ */
+void input_latency_start(struct input_latency *latency,
+        enum input_latency_device device, void *proxy);
+void input_latency_stop(struct input_latency *latency,
+        enum input_latency_device device);
+
+/* Call from the handler of every event of the type */
+void input_latency_mark(struct input_latency *latency,
+        enum input_latency_type type);
+
+/* Moves what is pending into the tag of a frame being planned */
+void input_latency_take(struct input_latency *latency, struct input_tag *tag);
+/* Puts back the tag of a frame that is thrown away without a commit */
+void input_latency_restore(struct input_latency *latency,
+        const struct input_tag *tag);
+/* Records the frame committed at commit_ns and clears its tag */
+void input_latency_commit(struct input_latency *latency,
+        struct input_tag *tag, uint64_t commit_ns);
+
+void input_latency_report(const struct input_latency *latency, FILE *out);
+
+#endif
@@ -0,0 +1,707 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "input_trace.h"
+#include "shm.h"
+
+#define TRACE_MAGIC 0x43525449 /* "ITRC" */
+#define TRACE_VERSION 1
+#define TRACE_INITIAL_SIZE (1 << 20)
+
+enum trace_type {
+    TRACE_POINTER_ENTER,        /* serial, x, y */
+    TRACE_POINTER_LEAVE,        /* serial */
+    TRACE_POINTER_MOTION,       /* x, y */
+    TRACE_POINTER_BUTTON,       /* serial, button, state */
+    TRACE_POINTER_AXIS,         /* axis, value */
+    TRACE_POINTER_FRAME,
+    TRACE_POINTER_AXIS_SOURCE,  /* source */
+    TRACE_POINTER_AXIS_STOP,    /* axis */
+    TRACE_POINTER_AXIS_DISCRETE,/* axis, discrete */
+
+    TRACE_KEYBOARD_KEYMAP,      /* format, size, keymap text */
+    TRACE_KEYBOARD_ENTER,       /* serial, keys */
+    TRACE_KEYBOARD_LEAVE,       /* serial */
+    TRACE_KEYBOARD_KEY,         /* serial, key, state */
+    TRACE_KEYBOARD_MODIFIERS,   /* serial, depressed, latched, locked, group */
+    TRACE_KEYBOARD_REPEAT_INFO, /* rate, delay */
+
+    TRACE_TOUCH_DOWN,           /* serial, id, x, y */
+    TRACE_TOUCH_UP,             /* serial, id */
+    TRACE_TOUCH_MOTION,         /* id, x, y */
+    TRACE_TOUCH_FRAME,
+    TRACE_TOUCH_CANCEL,
+    TRACE_TOUCH_SHAPE,          /* id, major, minor */
+    TRACE_TOUCH_ORIENTATION,    /* id, orientation */
+};
+
+struct trace_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    /* Bytes of records that follow, updated after each record is complete */
+    uint64_t size;
+};
+
+/* Records are 8-byte aligned, args padded to fit */
+struct trace_record {
+    /* CLOCK_MONOTONIC on arrival */
+    uint64_t ns;
+    /* Wayland timestamp in ms, 0 for events without one */
+    uint32_t time;
+    uint16_t type;
+    uint16_t reserved;
+    /* Bytes in args */
+    uint32_t size;
+    uint32_t args[];
+};
+
+struct input_trace {
+    struct input_listeners forward;
+    int fd;
+    char *map;
+    size_t map_size;
+    bool failed;
+};
+
+static size_t
+record_size(size_t args_size)
+{
+    return (sizeof(struct trace_record) + args_size + 7) & ~(size_t)7;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Returns where args_size bytes of args go, NULL once recording failed */
+static uint32_t *
+record_begin(struct input_trace *trace, enum trace_type type, uint32_t time,
+        size_t args_size)
+{
+    if (trace->failed) {
+        return NULL;
+    }
+
+    struct trace_header *header = (struct trace_header *)trace->map;
+    size_t end = sizeof(*header) + header->size + record_size(args_size);
+    if (end > trace->map_size) {
+        size_t map_size = trace->map_size;
+        while (map_size < end) {
+            map_size *= 2;
+        }
+        char *map = MAP_FAILED;
+        if (ftruncate(trace->fd, map_size) == 0) {
+            map = mremap(trace->map, trace->map_size, map_size,
+                    MREMAP_MAYMOVE);
+        }
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "input trace: %s, recording stopped\n",
+                    strerror(errno));
+            trace->failed = true;
+            return NULL;
+        }
+        trace->map = map;
+        trace->map_size = map_size;
+        header = (struct trace_header *)map;
+    }
+
+    struct trace_record *record = (struct trace_record *)
+        (trace->map + sizeof(*header) + header->size);
+    memset(record, 0, record_size(args_size));
+    record->ns = now_ns();
+    record->time = time;
+    record->type = type;
+    record->size = args_size;
+    return record->args;
+}
+
+static void
+record_end(struct input_trace *trace)
+{
+    struct trace_header *header = (struct trace_header *)trace->map;
+    struct trace_record *record = (struct trace_record *)
+        (trace->map + sizeof(*header) + header->size);
+    /* Readers never see a partial record */
+    atomic_store_explicit((_Atomic uint64_t *)&header->size,
+            header->size + record_size(record->size), memory_order_release);
+}
+
+static void
+record(struct input_trace *trace, enum trace_type type, uint32_t time,
+        const uint32_t *args, size_t nargs)
+{
+    uint32_t *dst = record_begin(trace, type, time, nargs * sizeof(*args));
+    if (dst != NULL) {
+        if (nargs > 0) {
+            memcpy(dst, args, nargs * sizeof(*args));
+        }
+        record_end(trace);
+    }
+}
+
+#define RECORD(trace, type, time, ...) \
+    record((trace), (type), (time), (const uint32_t[]){ __VA_ARGS__ }, \
+            sizeof((uint32_t[]){ __VA_ARGS__ }) / sizeof(uint32_t))
+
+static void
+pointer_enter(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
+        struct wl_surface *surface, wl_fixed_t x, wl_fixed_t y)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_ENTER, 0, serial, x, y);
+    trace->forward.pointer->enter(trace->forward.data, wl_pointer,
+            serial, surface, x, y);
+}
+
+static void
+pointer_leave(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
+        struct wl_surface *surface)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_LEAVE, 0, serial);
+    trace->forward.pointer->leave(trace->forward.data, wl_pointer,
+            serial, surface);
+}
+
+static void
+pointer_motion(void *data, struct wl_pointer *wl_pointer, uint32_t time,
+        wl_fixed_t x, wl_fixed_t y)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_MOTION, time, x, y);
+    trace->forward.pointer->motion(trace->forward.data, wl_pointer, time, x, y);
+}
+
+static void
+pointer_button(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
+        uint32_t time, uint32_t button, uint32_t state)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_BUTTON, time, serial, button, state);
+    trace->forward.pointer->button(trace->forward.data, wl_pointer,
+            serial, time, button, state);
+}
+
+static void
+pointer_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
+        uint32_t axis, wl_fixed_t value)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_AXIS, time, axis, value);
+    trace->forward.pointer->axis(trace->forward.data, wl_pointer,
+            time, axis, value);
+}
+
+static void
+pointer_frame(void *data, struct wl_pointer *wl_pointer)
+{
+    struct input_trace *trace = data;
+    record(trace, TRACE_POINTER_FRAME, 0, NULL, 0);
+    trace->forward.pointer->frame(trace->forward.data, wl_pointer);
+}
+
+static void
+pointer_axis_source(void *data, struct wl_pointer *wl_pointer,
+        uint32_t source)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_AXIS_SOURCE, 0, source);
+    trace->forward.pointer->axis_source(trace->forward.data, wl_pointer,
+            source);
+}
+
+static void
+pointer_axis_stop(void *data, struct wl_pointer *wl_pointer, uint32_t time,
+        uint32_t axis)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_AXIS_STOP, time, axis);
+    trace->forward.pointer->axis_stop(trace->forward.data, wl_pointer,
+            time, axis);
+}
+
+static void
+pointer_axis_discrete(void *data, struct wl_pointer *wl_pointer,
+        uint32_t axis, int32_t discrete)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_POINTER_AXIS_DISCRETE, 0, axis, discrete);
+    trace->forward.pointer->axis_discrete(trace->forward.data, wl_pointer,
+            axis, discrete);
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+    .enter = pointer_enter,
+    .leave = pointer_leave,
+    .motion = pointer_motion,
+    .button = pointer_button,
+    .axis = pointer_axis,
+    .frame = pointer_frame,
+    .axis_source = pointer_axis_source,
+    .axis_stop = pointer_axis_stop,
+    .axis_discrete = pointer_axis_discrete,
+};
+
+static void
+keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard, uint32_t format,
+        int32_t fd, uint32_t size)
+{
+    struct input_trace *trace = data;
+    void *keymap = MAP_FAILED;
+    if (format == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+        keymap = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    size_t keymap_size = keymap != MAP_FAILED ? size : 0;
+
+    uint32_t *args = record_begin(trace, TRACE_KEYBOARD_KEYMAP, 0,
+            2 * sizeof(uint32_t) + keymap_size);
+    if (args != NULL) {
+        args[0] = format;
+        args[1] = keymap_size;
+        if (keymap_size > 0) {
+            memcpy(&args[2], keymap, keymap_size);
+        }
+        record_end(trace);
+    }
+    if (keymap != MAP_FAILED) {
+        munmap(keymap, size);
+    }
+
+    trace->forward.keyboard->keymap(trace->forward.data, wl_keyboard,
+            format, fd, size);
+}
+
+static void
+keyboard_enter(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial,
+        struct wl_surface *surface, struct wl_array *keys)
+{
+    struct input_trace *trace = data;
+    uint32_t *args = record_begin(trace, TRACE_KEYBOARD_ENTER, 0,
+            sizeof(uint32_t) + keys->size);
+    if (args != NULL) {
+        args[0] = serial;
+        memcpy(&args[1], keys->data, keys->size);
+        record_end(trace);
+    }
+    trace->forward.keyboard->enter(trace->forward.data, wl_keyboard,
+            serial, surface, keys);
+}
+
+static void
+keyboard_leave(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial,
+        struct wl_surface *surface)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_KEYBOARD_LEAVE, 0, serial);
+    trace->forward.keyboard->leave(trace->forward.data, wl_keyboard,
+            serial, surface);
+}
+
+static void
+keyboard_key(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial,
+        uint32_t time, uint32_t key, uint32_t state)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_KEYBOARD_KEY, time, serial, key, state);
+    trace->forward.keyboard->key(trace->forward.data, wl_keyboard,
+            serial, time, key, state);
+}
+
+static void
+keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+        uint32_t serial, uint32_t depressed, uint32_t latched,
+        uint32_t locked, uint32_t group)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_KEYBOARD_MODIFIERS, 0,
+            serial, depressed, latched, locked, group);
+    trace->forward.keyboard->modifiers(trace->forward.data, wl_keyboard,
+            serial, depressed, latched, locked, group);
+}
+
+static void
+keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
+        int32_t rate, int32_t delay)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_KEYBOARD_REPEAT_INFO, 0, rate, delay);
+    trace->forward.keyboard->repeat_info(trace->forward.data, wl_keyboard,
+            rate, delay);
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+    .keymap = keyboard_keymap,
+    .enter = keyboard_enter,
+    .leave = keyboard_leave,
+    .key = keyboard_key,
+    .modifiers = keyboard_modifiers,
+    .repeat_info = keyboard_repeat_info,
+};
+
+static void
+touch_down(void *data, struct wl_touch *wl_touch, uint32_t serial,
+        uint32_t time, struct wl_surface *surface, int32_t id,
+        wl_fixed_t x, wl_fixed_t y)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_TOUCH_DOWN, time, serial, id, x, y);
+    trace->forward.touch->down(trace->forward.data, wl_touch,
+            serial, time, surface, id, x, y);
+}
+
+static void
+touch_up(void *data, struct wl_touch *wl_touch, uint32_t serial,
+        uint32_t time, int32_t id)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_TOUCH_UP, time, serial, id);
+    trace->forward.touch->up(trace->forward.data, wl_touch, serial, time, id);
+}
+
+static void
+touch_motion(void *data, struct wl_touch *wl_touch, uint32_t time,
+        int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_TOUCH_MOTION, time, id, x, y);
+    trace->forward.touch->motion(trace->forward.data, wl_touch, time, id, x, y);
+}
+
+static void
+touch_frame(void *data, struct wl_touch *wl_touch)
+{
+    struct input_trace *trace = data;
+    record(trace, TRACE_TOUCH_FRAME, 0, NULL, 0);
+    trace->forward.touch->frame(trace->forward.data, wl_touch);
+}
+
+static void
+touch_cancel(void *data, struct wl_touch *wl_touch)
+{
+    struct input_trace *trace = data;
+    record(trace, TRACE_TOUCH_CANCEL, 0, NULL, 0);
+    trace->forward.touch->cancel(trace->forward.data, wl_touch);
+}
+
+static void
+touch_shape(void *data, struct wl_touch *wl_touch, int32_t id,
+        wl_fixed_t major, wl_fixed_t minor)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_TOUCH_SHAPE, 0, id, major, minor);
+    trace->forward.touch->shape(trace->forward.data, wl_touch,
+            id, major, minor);
+}
+
+static void
+touch_orientation(void *data, struct wl_touch *wl_touch, int32_t id,
+        wl_fixed_t orientation)
+{
+    struct input_trace *trace = data;
+    RECORD(trace, TRACE_TOUCH_ORIENTATION, 0, id, orientation);
+    trace->forward.touch->orientation(trace->forward.data, wl_touch,
+            id, orientation);
+}
+
+static const struct wl_touch_listener touch_listener = {
+    .down = touch_down,
+    .up = touch_up,
+    .motion = touch_motion,
+    .frame = touch_frame,
+    .cancel = touch_cancel,
+    .shape = touch_shape,
+    .orientation = touch_orientation,
+};
+
+struct input_trace *
+input_trace_create(const char *path, const struct input_listeners *forward)
+{
+    struct input_trace *trace = calloc(1, sizeof(*trace));
+    if (trace == NULL) {
+        return NULL;
+    }
+    trace->forward = *forward;
+    trace->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace->fd < 0) {
+        goto err_free;
+    }
+    trace->map_size = TRACE_INITIAL_SIZE;
+    if (ftruncate(trace->fd, trace->map_size) < 0) {
+        goto err_close;
+    }
+    trace->map = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED, trace->fd, 0);
+    if (trace->map == MAP_FAILED) {
+        goto err_close;
+    }
+
+    struct trace_header *header = (struct trace_header *)trace->map;
+    header->magic = TRACE_MAGIC;
+    header->version = TRACE_VERSION;
+    header->size = 0;
+    return trace;
+
+err_close:
+    close(trace->fd);
+    unlink(path);
+err_free:
+    free(trace);
+    return NULL;
+}
+
+void
+input_trace_destroy(struct input_trace *trace)
+{
+    if (trace == NULL) {
+        return;
+    }
+    /* Drop the unused tail of the last growth step */
+    struct trace_header *header = (struct trace_header *)trace->map;
+    size_t size = sizeof(*header) + header->size;
+    munmap(trace->map, trace->map_size);
+    if (ftruncate(trace->fd, size) < 0) {
+        perror("input trace");
+    }
+    close(trace->fd);
+    free(trace);
+}
+
+void
+input_trace_add_pointer(struct input_trace *trace,
+        struct wl_pointer *wl_pointer)
+{
+    wl_pointer_add_listener(wl_pointer, &pointer_listener, trace);
+}
+
+void
+input_trace_add_keyboard(struct input_trace *trace,
+        struct wl_keyboard *wl_keyboard)
+{
+    wl_keyboard_add_listener(wl_keyboard, &keyboard_listener, trace);
+}
+
+void
+input_trace_add_touch(struct input_trace *trace, struct wl_touch *wl_touch)
+{
+    wl_touch_add_listener(wl_touch, &touch_listener, trace);
+}
+
+static void
+replay_keymap(const struct input_listeners *listeners,
+        const struct trace_record *record)
+{
+    uint32_t format = record->args[0];
+    uint32_t size = record->args[1];
+    if (size > record->size - 2 * sizeof(uint32_t)) {
+        return;
+    }
+    /* The handler owns the fd, as it would one from the compositor */
+    int fd = allocate_shm_file(size, 0);
+    if (fd < 0) {
+        return;
+    }
+    if (pwrite(fd, &record->args[2], size, 0) != (ssize_t)size) {
+        close(fd);
+        return;
+    }
+    listeners->keyboard->keymap(listeners->data, NULL, format, fd, size);
+}
+
+/* Minimum args each record type needs */
+static const uint8_t replay_nargs[] = {
+    [TRACE_POINTER_ENTER] = 3,
+    [TRACE_POINTER_LEAVE] = 1,
+    [TRACE_POINTER_MOTION] = 2,
+    [TRACE_POINTER_BUTTON] = 3,
+    [TRACE_POINTER_AXIS] = 2,
+    [TRACE_POINTER_AXIS_SOURCE] = 1,
+    [TRACE_POINTER_AXIS_STOP] = 1,
+    [TRACE_POINTER_AXIS_DISCRETE] = 2,
+    [TRACE_KEYBOARD_KEYMAP] = 2,
+    [TRACE_KEYBOARD_ENTER] = 1,
+    [TRACE_KEYBOARD_LEAVE] = 1,
+    [TRACE_KEYBOARD_KEY] = 3,
+    [TRACE_KEYBOARD_MODIFIERS] = 5,
+    [TRACE_KEYBOARD_REPEAT_INFO] = 2,
+    [TRACE_TOUCH_DOWN] = 4,
+    [TRACE_TOUCH_UP] = 2,
+    [TRACE_TOUCH_MOTION] = 3,
+    [TRACE_TOUCH_SHAPE] = 3,
+    [TRACE_TOUCH_ORIENTATION] = 2,
+};
+
+static void
+replay_record(const struct input_listeners *listeners,
+        const struct trace_record *record)
+{
+    const struct wl_pointer_listener *pointer = listeners->pointer;
+    const struct wl_keyboard_listener *keyboard = listeners->keyboard;
+    const struct wl_touch_listener *touch = listeners->touch;
+    void *data = listeners->data;
+    const uint32_t *a = record->args;
+    uint32_t time = record->time;
+
+    switch (record->type) {
+    case TRACE_POINTER_ENTER:
+        pointer->enter(data, NULL, a[0], NULL, a[1], a[2]);
+        break;
+    case TRACE_POINTER_LEAVE:
+        pointer->leave(data, NULL, a[0], NULL);
+        break;
+    case TRACE_POINTER_MOTION:
+        pointer->motion(data, NULL, time, a[0], a[1]);
+        break;
+    case TRACE_POINTER_BUTTON:
+        pointer->button(data, NULL, a[0], time, a[1], a[2]);
+        break;
+    case TRACE_POINTER_AXIS:
+        pointer->axis(data, NULL, time, a[0] & 1, a[1]);
+        break;
+    case TRACE_POINTER_FRAME:
+        pointer->frame(data, NULL);
+        break;
+    case TRACE_POINTER_AXIS_SOURCE:
+        pointer->axis_source(data, NULL, a[0]);
+        break;
+    case TRACE_POINTER_AXIS_STOP:
+        pointer->axis_stop(data, NULL, time, a[0] & 1);
+        break;
+    case TRACE_POINTER_AXIS_DISCRETE:
+        pointer->axis_discrete(data, NULL, a[0] & 1, a[1]);
+        break;
+
+    case TRACE_KEYBOARD_KEYMAP:
+        replay_keymap(listeners, record);
+        break;
+    case TRACE_KEYBOARD_ENTER: {
+        size_t size = (record->size - sizeof(uint32_t)) & ~(size_t)3;
+        struct wl_array keys = {
+            .size = size,
+            .alloc = size,
+            .data = (void *)&a[1],
+        };
+        keyboard->enter(data, NULL, a[0], NULL, &keys);
+        break;
+    }
+    case TRACE_KEYBOARD_LEAVE:
+        keyboard->leave(data, NULL, a[0], NULL);
+        break;
+    case TRACE_KEYBOARD_KEY:
+        keyboard->key(data, NULL, a[0], time, a[1], a[2]);
+        break;
+    case TRACE_KEYBOARD_MODIFIERS:
+        keyboard->modifiers(data, NULL, a[0], a[1], a[2], a[3], a[4]);
+        break;
+    case TRACE_KEYBOARD_REPEAT_INFO:
+        keyboard->repeat_info(data, NULL, a[0], a[1]);
+        break;
+
+    case TRACE_TOUCH_DOWN:
+        touch->down(data, NULL, a[0], time, NULL, a[1], a[2], a[3]);
+        break;
+    case TRACE_TOUCH_UP:
+        touch->up(data, NULL, a[0], time, a[1]);
+        break;
+    case TRACE_TOUCH_MOTION:
+        touch->motion(data, NULL, time, a[0], a[1], a[2]);
+        break;
+    case TRACE_TOUCH_FRAME:
+        touch->frame(data, NULL);
+        break;
+    case TRACE_TOUCH_CANCEL:
+        touch->cancel(data, NULL);
+        break;
+    case TRACE_TOUCH_SHAPE:
+        touch->shape(data, NULL, a[0], a[1], a[2]);
+        break;
+    case TRACE_TOUCH_ORIENTATION:
+        touch->orientation(data, NULL, a[0], a[1]);
+        break;
+    }
+}
+
+long
+input_trace_replay(const char *path, const struct input_listeners *listeners,
+        bool realtime)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct trace_header)) {
+        close(fd);
+        return -1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    const struct trace_header *header = (const struct trace_header *)map;
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    /* A trace cut short by a crash still has its header's worth */
+    size_t end = sizeof(*header) + header->size;
+    if (end > (size_t)st.st_size) {
+        end = st.st_size;
+    }
+
+    long count = 0;
+    uint64_t first_ns = 0, start_ns = now_ns();
+    size_t offset = sizeof(*header);
+    while (offset + sizeof(struct trace_record) <= end) {
+        const struct trace_record *record =
+            (const struct trace_record *)(map + offset);
+        size_t size = record_size(record->size);
+        if (size > end - offset) {
+            break;
+        }
+        offset += size;
+
+        size_t nargs = record->type < sizeof(replay_nargs) ?
+            replay_nargs[record->type] : 0;
+        if (record->size < nargs * sizeof(uint32_t)) {
+            continue;
+        }
+
+        if (count == 0) {
+            first_ns = record->ns;
+        }
+        if (realtime) {
+            uint64_t due = start_ns + (record->ns - first_ns);
+            struct timespec ts = {
+                .tv_sec = due / 1000000000,
+                .tv_nsec = due % 1000000000,
+            };
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+                        &ts, NULL) == EINTR) {
+                /* Keep sleeping */
+            }
+        }
+
+        replay_record(listeners, record);
+        ++count;
+    }
+
+    munmap(map, st.st_size);
+    return count;
+}
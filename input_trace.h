@@ -0,0 +1,44 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <stdbool.h>
+#include <wayland-client.h>
+
+/* The handlers a trace records in front of, or replays into */
+struct input_listeners {
+    const struct wl_pointer_listener *pointer;
+    const struct wl_keyboard_listener *keyboard;
+    const struct wl_touch_listener *touch;
+    void *data;
+};
+
+struct input_trace;
+
+/*
+ * Records every pointer, keyboard and touch event, with its arguments, its
+ * Wayland timestamp and the CLOCK_MONOTONIC time it arrived, to an mmap'd
+ * append-only file before passing it on to the forward listeners. What
+ * was recorded before a crash stays readable.
+ */
+struct input_trace *input_trace_create(const char *path,
+        const struct input_listeners *forward);
+void input_trace_destroy(struct input_trace *trace);
+
+/* Use instead of wl_*_add_listener() on the device */
+void input_trace_add_pointer(struct input_trace *trace,
+        struct wl_pointer *wl_pointer);
+void input_trace_add_keyboard(struct input_trace *trace,
+        struct wl_keyboard *wl_keyboard);
+void input_trace_add_touch(struct input_trace *trace,
+        struct wl_touch *wl_touch);
+
+/*
+ * Calls the listeners with every event in a recorded trace, spaced as they
+ * arrived when realtime is set or back to back otherwise. Proxies and
+ * surfaces are passed as NULL. Returns the number of events replayed, or
+ * -1 if the file is not a trace.
+ */
+long input_trace_replay(const char *path,
+        const struct input_listeners *listeners, bool realtime);
+
+#endif
@@ -0,0 +1,68 @@
+#include <stdint.h>
+#include "key_repeat.h"
+
+static void
+key_repeat_timer(void *data, uint64_t expirations)
+{
+    struct key_repeat *repeat = data;
+    /* More than one expiration means we were late: catch up */
+    for (uint64_t i = 0; i < expirations && repeat->key != 0; ++i)
+        repeat->func(repeat->data, repeat->key);
+}
+
+void
+key_repeat_init(struct key_repeat *repeat, struct event_loop *loop,
+        key_repeat_func func, void *data)
+{
+    repeat->timer = event_loop_add_timer(loop, key_repeat_timer, repeat);
+    repeat->func = func;
+    repeat->data = data;
+    repeat->rate = KEY_REPEAT_DEFAULT_RATE;
+    repeat->delay = KEY_REPEAT_DEFAULT_DELAY;
+    repeat->key = 0;
+}
+
+void
+key_repeat_finish(struct key_repeat *repeat)
+{
+    event_source_remove(repeat->timer);
+    repeat->timer = NULL;
+    repeat->key = 0;
+}
+
+void
+key_repeat_set_info(struct key_repeat *repeat, int32_t rate, int32_t delay)
+{
+    repeat->rate = rate > 0 ? rate : 0;
+    repeat->delay = delay > 0 ? delay : 0;
+    if (repeat->rate == 0)
+        key_repeat_cancel(repeat);
+}
+
+void
+key_repeat_press(struct key_repeat *repeat, uint32_t key)
+{
+    if (repeat->timer == NULL || repeat->rate == 0)
+        return;
+    repeat->key = key;
+    uint64_t delay_ns = (uint64_t)repeat->delay * 1000000;
+    uint64_t interval_ns = 1000000000 / repeat->rate;
+    /* A zero it_value would disarm the timer instead */
+    event_source_timer_update(repeat->timer,
+            delay_ns > 0 ? delay_ns : 1, interval_ns);
+}
+
+void
+key_repeat_release(struct key_repeat *repeat, uint32_t key)
+{
+    if (repeat->key == key)
+        key_repeat_cancel(repeat);
+}
+
+void
+key_repeat_cancel(struct key_repeat *repeat)
+{
+    repeat->key = 0;
+    if (repeat->timer != NULL)
+        event_source_timer_update(repeat->timer, 0, 0);
+}
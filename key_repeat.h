@@ -0,0 +1,42 @@
+#ifndef KEY_REPEAT_H
+#define KEY_REPEAT_H
+
+#include <stdint.h>
+#include "event_loop.h"
+
+/* Used until the compositor sends wl_keyboard.repeat_info */
+#define KEY_REPEAT_DEFAULT_RATE 25
+#define KEY_REPEAT_DEFAULT_DELAY 600
+
+/* Called once per synthesized repeat of the held key */
+typedef void (*key_repeat_func)(void *data, uint32_t key);
+
+/*
+ * Auto-repeat for the most recently pressed key, driven by a timerfd on the
+ * event loop. When the loop falls behind, every missed repeat is still
+ * delivered on the next dispatch.
+ */
+struct key_repeat {
+    struct event_source *timer;
+    key_repeat_func func;
+    void *data;
+    /* Keys per second (0 disables repeat) and delay before the first, ms */
+    int32_t rate, delay;
+    /* evdev keycode being repeated, 0 for none */
+    uint32_t key;
+};
+
+void key_repeat_init(struct key_repeat *repeat, struct event_loop *loop,
+        key_repeat_func func, void *data);
+void key_repeat_finish(struct key_repeat *repeat);
+
+void key_repeat_set_info(struct key_repeat *repeat,
+        int32_t rate, int32_t delay);
+
+/* Start repeating key, replacing whatever key was repeating before */
+void key_repeat_press(struct key_repeat *repeat, uint32_t key);
+/* Stop if key is the one repeating */
+void key_repeat_release(struct key_repeat *repeat, uint32_t key);
+void key_repeat_cancel(struct key_repeat *repeat);
+
+#endif
@@ -0,0 +1,77 @@
+#include <string.h>
+#include <sys/mman.h>
+#include "keymap_cache.h"
+
+/* FNV-1a, far cheaper than compiling even for a 100 KiB keymap */
+static uint64_t
+hash_buffer(const char *buffer, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (unsigned char)buffer[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void
+keymap_cache_init(struct keymap_cache *cache, struct xkb_context *xkb_context)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->xkb_context = xkb_context;
+}
+
+void
+keymap_cache_finish(struct keymap_cache *cache)
+{
+    for (int i = 0; i < KEYMAP_CACHE_SIZE; ++i)
+        xkb_keymap_unref(cache->entries[i].keymap);
+    memset(cache, 0, sizeof(*cache));
+}
+
+struct xkb_keymap *
+keymap_cache_get(struct keymap_cache *cache, const char *buffer, size_t size)
+{
+    /* The text is NUL terminated and size counts the terminator */
+    while (size > 0 && buffer[size - 1] == '\0')
+        --size;
+    uint64_t hash = hash_buffer(buffer, size);
+
+    struct keymap_cache_entry *victim = &cache->entries[0];
+    for (int i = 0; i < KEYMAP_CACHE_SIZE; ++i) {
+        struct keymap_cache_entry *entry = &cache->entries[i];
+        if (entry->keymap != NULL
+                && entry->hash == hash && entry->size == size) {
+            entry->last_used = ++cache->clock;
+            return xkb_keymap_ref(entry->keymap);
+        }
+        if (entry->last_used < victim->last_used)
+            victim = entry;
+    }
+
+    /* Parse straight from the mapping, no copy and no strlen */
+    struct xkb_keymap *keymap = xkb_keymap_new_from_buffer(
+            cache->xkb_context, buffer, size,
+            XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (keymap == NULL)
+        return NULL;
+
+    xkb_keymap_unref(victim->keymap);
+    victim->hash = hash;
+    victim->size = size;
+    victim->last_used = ++cache->clock;
+    victim->keymap = xkb_keymap_ref(keymap);
+    return keymap;
+}
+
+struct xkb_keymap *
+keymap_cache_get_fd(struct keymap_cache *cache, int fd, size_t size)
+{
+    /* MAP_PRIVATE: compositors may hand out a sealed, read-only file */
+    char *map_shm = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map_shm == MAP_FAILED)
+        return NULL;
+    struct xkb_keymap *keymap = keymap_cache_get(cache, map_shm, size);
+    munmap(map_shm, size);
+    return keymap;
+}
@@ -0,0 +1,40 @@
+#ifndef KEYMAP_CACHE_H
+#define KEYMAP_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+/* Keymaps kept compiled, enough for a few layouts switched back and forth */
+#define KEYMAP_CACHE_SIZE 4
+
+struct keymap_cache_entry {
+    uint64_t hash;
+    size_t size;
+    uint64_t last_used;
+    struct xkb_keymap *keymap;
+};
+
+/*
+ * Compiled keymaps keyed by a hash of their text, so a keymap the
+ * compositor sends again (layout switch, seat hotplug) is not recompiled.
+ */
+struct keymap_cache {
+    struct xkb_context *xkb_context;
+    uint64_t clock;
+    struct keymap_cache_entry entries[KEYMAP_CACHE_SIZE];
+};
+
+void keymap_cache_init(struct keymap_cache *cache,
+        struct xkb_context *xkb_context);
+void keymap_cache_finish(struct keymap_cache *cache);
+
+/* Returns a new reference, or NULL if the keymap does not compile */
+struct xkb_keymap *keymap_cache_get(struct keymap_cache *cache,
+        const char *buffer, size_t size);
+
+/* Maps a wl_keyboard.keymap fd and looks it up; does not close fd */
+struct xkb_keymap *keymap_cache_get_fd(struct keymap_cache *cache,
+        int fd, size_t size);
+
+#endif
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include "keysym_cache.h"
+
+static void
+fill_entry(struct xkb_state *xkb_state, xkb_keycode_t keycode,
+        struct keysym_entry *entry)
+{
+    entry->sym = xkb_state_key_get_one_sym(xkb_state, keycode);
+    xkb_state_key_get_utf8(xkb_state, keycode,
+            entry->utf8, sizeof(entry->utf8));
+}
+
+void
+keysym_cache_init(struct keysym_cache *cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+void
+keysym_cache_finish(struct keysym_cache *cache)
+{
+    for (int i = 0; i < KEYSYM_CACHE_TABLES; ++i)
+        free(cache->tables[i].entries);
+    memset(cache, 0, sizeof(*cache));
+}
+
+void
+keysym_cache_set_state(struct keysym_cache *cache,
+        struct xkb_state *xkb_state)
+{
+    struct xkb_keymap *keymap = xkb_state_get_keymap(xkb_state);
+    xkb_keycode_t min = xkb_keymap_min_keycode(keymap);
+    xkb_keycode_t max = xkb_keymap_max_keycode(keymap);
+    size_t nkeys = max >= min ? max - min + 1 : 0;
+
+    for (int i = 0; i < KEYSYM_CACHE_TABLES; ++i) {
+        struct keysym_table *table = &cache->tables[i];
+        free(table->entries);
+        table->entries = nkeys > 0 ? calloc(nkeys, sizeof(*table->entries))
+            : NULL;
+        /* Never matches a real state, so the table is free for reuse */
+        table->mods = 0;
+        table->layout = XKB_LAYOUT_INVALID;
+        table->last_used = 0;
+    }
+    cache->xkb_state = xkb_state;
+    cache->min_keycode = min;
+    cache->max_keycode = max;
+    cache->current = NULL;
+    keysym_cache_update(cache);
+}
+
+void
+keysym_cache_update(struct keysym_cache *cache)
+{
+    if (cache->xkb_state == NULL)
+        return;
+    xkb_mod_mask_t mods = xkb_state_serialize_mods(cache->xkb_state,
+            XKB_STATE_MODS_EFFECTIVE);
+    xkb_layout_index_t layout = xkb_state_serialize_layout(cache->xkb_state,
+            XKB_STATE_LAYOUT_EFFECTIVE);
+
+    /* Reuse the table for this state, or evict the least recently used */
+    struct keysym_table *table = NULL;
+    for (int i = 0; i < KEYSYM_CACHE_TABLES; ++i) {
+        struct keysym_table *t = &cache->tables[i];
+        if (t->mods == mods && t->layout == layout) {
+            table = t;
+            break;
+        }
+        if (table == NULL || t->last_used < table->last_used)
+            table = t;
+    }
+    if (table->mods != mods || table->layout != layout) {
+        table->mods = mods;
+        table->layout = layout;
+        /* Invalidates every entry at once; 0 is never a live generation */
+        table->generation = ++cache->generation;
+    }
+    table->last_used = ++cache->clock;
+    cache->current = table;
+}
+
+const struct keysym_entry *
+keysym_cache_lookup(struct keysym_cache *cache, xkb_keycode_t keycode)
+{
+    static struct keysym_entry uncached;
+    struct keysym_table *table = cache->current;
+    if (table == NULL || table->entries == NULL
+            || keycode < cache->min_keycode || keycode > cache->max_keycode) {
+        if (cache->xkb_state == NULL) {
+            memset(&uncached, 0, sizeof(uncached));
+            return &uncached;
+        }
+        fill_entry(cache->xkb_state, keycode, &uncached);
+        return &uncached;
+    }
+
+    struct keysym_entry *entry =
+        &table->entries[keycode - cache->min_keycode];
+    if (entry->generation != table->generation) {
+        fill_entry(cache->xkb_state, keycode, entry);
+        entry->generation = table->generation;
+    }
+    return entry;
+}
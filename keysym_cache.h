@@ -0,0 +1,53 @@
+#ifndef KEYSYM_CACHE_H
+#define KEYSYM_CACHE_H
+
+#include <stdint.h>
+#include <xkbcommon/xkbcommon.h>
+
+/* Distinct modifier/layout combinations kept, e.g. none, Shift, AltGr */
+#define KEYSYM_CACHE_TABLES 4
+
+struct keysym_entry {
+    /* Table generation the entry was filled in, stale if it differs */
+    uint32_t generation;
+    xkb_keysym_t sym;
+    char utf8[16];
+};
+
+struct keysym_table {
+    xkb_mod_mask_t mods;
+    xkb_layout_index_t layout;
+    uint32_t generation;
+    uint64_t last_used;
+    struct keysym_entry *entries;
+};
+
+/*
+ * What xkb_state_key_get_one_sym and xkb_state_key_get_utf8 return for
+ * each keycode, cached per effective modifier mask and layout. Entries are
+ * filled on first lookup, so a new keymap or modifier state costs nothing
+ * until keys are pressed.
+ */
+struct keysym_cache {
+    struct xkb_state *xkb_state;
+    xkb_keycode_t min_keycode, max_keycode;
+    uint32_t generation;
+    uint64_t clock;
+    struct keysym_table tables[KEYSYM_CACHE_TABLES];
+    struct keysym_table *current;
+};
+
+void keysym_cache_init(struct keysym_cache *cache);
+void keysym_cache_finish(struct keysym_cache *cache);
+
+/* After wl_keyboard.keymap: drops everything cached for the old keymap */
+void keysym_cache_set_state(struct keysym_cache *cache,
+        struct xkb_state *xkb_state);
+
+/* After wl_keyboard.modifiers: selects the table for the new state */
+void keysym_cache_update(struct keysym_cache *cache);
+
+const struct keysym_entry *keysym_cache_lookup(struct keysym_cache *cache,
+        xkb_keycode_t keycode);
+
+#endif
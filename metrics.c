@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "metrics.h"
+
+/* Readers give up on a page that is mid-update this many times in a row */
+#define SNAPSHOT_ATTEMPTS 64
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int
+metrics_open(struct metrics *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    snprintf(metrics->name, sizeof(metrics->name),
+            "/" METRICS_NAME_PREFIX "%d", (int)getpid());
+    /* A page left by a crashed client with our pid is ours now */
+    int fd = shm_open(metrics->name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct metrics_page)) < 0) {
+        int saved = errno;
+        close(fd);
+        shm_unlink(metrics->name);
+        errno = saved;
+        return -1;
+    }
+    struct metrics_page *page = mmap(NULL, sizeof(*page),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int saved = errno;
+    close(fd);
+    if (page == MAP_FAILED) {
+        shm_unlink(metrics->name);
+        errno = saved;
+        return -1;
+    }
+
+    page->version = METRICS_VERSION;
+    page->nvalues = METRICS_VALUE_COUNT;
+    page->pid = getpid();
+    page->start_ns = now_ns();
+    atomic_store_explicit(&page->updated_ns, page->start_ns,
+            memory_order_relaxed);
+    /* Readers skip the page until the header is complete */
+    atomic_store_explicit((_Atomic uint32_t *)&page->magic, METRICS_MAGIC,
+            memory_order_release);
+    metrics->page = page;
+    return 0;
+}
+
+void
+metrics_close(struct metrics *metrics)
+{
+    if (metrics->page == NULL) {
+        return;
+    }
+    munmap(metrics->page, sizeof(*metrics->page));
+    shm_unlink(metrics->name);
+    metrics->page = NULL;
+}
+
+void
+metrics_begin(struct metrics *metrics)
+{
+    struct metrics_page *page = metrics->page;
+    if (page == NULL) {
+        return;
+    }
+    uint64_t seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+    atomic_store_explicit(&page->seq, seq + 1, memory_order_relaxed);
+    /* The odd seq is visible before any of the values change */
+    atomic_thread_fence(memory_order_release);
+}
+
+void
+metrics_end(struct metrics *metrics)
+{
+    struct metrics_page *page = metrics->page;
+    if (page == NULL) {
+        return;
+    }
+    atomic_store_explicit(&page->updated_ns, now_ns(), memory_order_relaxed);
+    uint64_t seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+    atomic_store_explicit(&page->seq, seq + 1, memory_order_release);
+}
+
+void
+metrics_add(struct metrics *metrics, enum metrics_value value, uint64_t n)
+{
+    struct metrics_page *page = metrics->page;
+    if (page == NULL) {
+        return;
+    }
+    /* We are the only writer, no need for a locked add */
+    atomic_store_explicit(&page->values[value],
+            atomic_load_explicit(&page->values[value], memory_order_relaxed)
+            + n, memory_order_relaxed);
+}
+
+void
+metrics_set(struct metrics *metrics, enum metrics_value value, uint64_t n)
+{
+    struct metrics_page *page = metrics->page;
+    if (page == NULL) {
+        return;
+    }
+    atomic_store_explicit(&page->values[value], n, memory_order_relaxed);
+}
+
+void
+metrics_count(struct metrics *metrics, enum metrics_value value)
+{
+    if (metrics == NULL || metrics->page == NULL) {
+        return;
+    }
+    metrics_begin(metrics);
+    metrics_add(metrics, value, 1);
+    metrics_end(metrics);
+}
+
+int
+metrics_snapshot(const struct metrics_page *page,
+        struct metrics_snapshot *snapshot)
+{
+    /* The reader maps the page read-only, loads don't write */
+    struct metrics_page *shared = (struct metrics_page *)page;
+    for (int attempt = 0; attempt < SNAPSHOT_ATTEMPTS; ++attempt) {
+        uint64_t seq = atomic_load_explicit(&shared->seq,
+                memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        snapshot->updated_ns = atomic_load_explicit(&shared->updated_ns,
+                memory_order_relaxed);
+        for (int i = 0; i < METRICS_VALUE_COUNT; ++i) {
+            snapshot->values[i] = atomic_load_explicit(&shared->values[i],
+                    memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&shared->seq, memory_order_relaxed) == seq) {
+            return 0;
+        }
+    }
+    return -1;
+}
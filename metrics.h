@@ -0,0 +1,93 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Live metrics in a shared memory page, /dev/shm/wl-metrics-<pid>, for
+ * monitoring to scrape without stopping or talking to the client; see
+ * metrics_read. The client is the only writer and brackets every update
+ * with a seqlock, so a reader either gets a consistent copy or retries.
+ */
+
+#define METRICS_MAGIC 0x54454d57 /* "WMET" */
+/* Bumped whenever the page layout or the meaning of a value changes */
+#define METRICS_VERSION 1
+#define METRICS_NAME_PREFIX "wl-metrics-"
+
+enum metrics_value {
+    /* Counters, which only go up */
+    METRICS_FRAMES,             /* frame callbacks */
+    METRICS_LATE_FRAMES,        /* over the frame deadline */
+    METRICS_MISSED_REFRESHES,   /* callback intervals over a refresh */
+    METRICS_SKIPPED_REFRESHES,  /* per wp_presentation */
+    METRICS_POINTER_FRAMES,
+    METRICS_POINTER_MOTIONS,
+    METRICS_POINTER_BUTTONS,
+    METRICS_POINTER_AXES,
+    METRICS_KEYS,
+    METRICS_TOUCH_FRAMES,
+    METRICS_BUFFER_RELEASES,
+    METRICS_COUNTER_COUNT,
+
+    /* Gauges, as of the last frame */
+    METRICS_SHM_BYTES = METRICS_COUNTER_COUNT,  /* mapped for wl_shm pools */
+    METRICS_POOL_BUFFERS,       /* in the frame buffer pool */
+    METRICS_POOL_BUSY,          /* of those, held by the compositor */
+    METRICS_VALUE_COUNT,
+};
+
+struct metrics_page {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nvalues;
+    int32_t pid;
+    uint32_t reserved;
+    /* CLOCK_MONOTONIC when the client started publishing */
+    uint64_t start_ns;
+
+    /* Odd while an update is in progress */
+    _Alignas(64) _Atomic uint64_t seq;
+    /* CLOCK_MONOTONIC of the last update */
+    _Atomic uint64_t updated_ns;
+    _Atomic uint64_t values[METRICS_VALUE_COUNT];
+};
+
+/* The writer's handle; every call is a no-op when page is NULL */
+struct metrics {
+    struct metrics_page *page;
+    char name[32];
+};
+
+/* A consistent copy of a page */
+struct metrics_snapshot {
+    uint64_t updated_ns;
+    uint64_t values[METRICS_VALUE_COUNT];
+};
+
+/* Creates and maps the page; returns -1 with errno set on failure */
+int metrics_open(struct metrics *metrics);
+/* Unmaps and removes the page */
+void metrics_close(struct metrics *metrics);
+
+/* Everything set or added in between is seen by readers at once */
+void metrics_begin(struct metrics *metrics);
+void metrics_end(struct metrics *metrics);
+void metrics_add(struct metrics *metrics, enum metrics_value value,
+        uint64_t n);
+void metrics_set(struct metrics *metrics, enum metrics_value value,
+        uint64_t n);
+
+/* Adds one to a counter in an update of its own; metrics may be NULL */
+void metrics_count(struct metrics *metrics, enum metrics_value value);
+
+/*
+ * Copies a page another process may be writing; returns -1 if it stayed
+ * mid-update for every attempt.
+ */
+int metrics_snapshot(const struct metrics_page *page,
+        struct metrics_snapshot *snapshot);
+
+#endif
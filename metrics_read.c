@@ -0,0 +1,245 @@
+/*
+ * Samples the metrics pages of every running client.
+ *
+ *     cc -o metrics_read metrics_read.c metrics.c
+ *     metrics_read [-i MS] [-n COUNT] [-c]
+ *
+ * Prints a line per client every -i ms (default 1000), -n times (default
+ * once, 0 for no limit). Rates are per second over the interval; the first
+ * sample only has totals to go by, since the client started. -c removes
+ * pages left behind by clients that are gone.
+ *
+ * Each page is mapped once and read with a few hundred bytes of copying,
+ * so sampling hundreds of clients costs next to nothing.
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "metrics.h"
+
+#define SHM_DIR "/dev/shm"
+
+struct client {
+    char name[NAME_MAX + 1];
+    const struct metrics_page *page;
+    struct metrics_snapshot last;
+    uint64_t last_ns;
+    bool seen;
+};
+
+static struct client *clients;
+static int nclients, clients_size;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static const struct metrics_page *
+map_page(const char *name)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), SHM_DIR "/%s", name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct metrics_page *page = mmap(NULL, sizeof(*page), PROT_READ,
+            MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        return NULL;
+    }
+    /* Still being set up, or from a client with another layout */
+    if (atomic_load_explicit((_Atomic uint32_t *)&page->magic,
+                memory_order_acquire) != METRICS_MAGIC
+            || page->version != METRICS_VERSION
+            || page->nvalues != METRICS_VALUE_COUNT) {
+        munmap(page, sizeof(*page));
+        return NULL;
+    }
+    return page;
+}
+
+static void
+drop_client(int i)
+{
+    munmap((void *)clients[i].page, sizeof(*clients[i].page));
+    clients[i] = clients[--nclients];
+}
+
+/* Maps pages that appeared since the last scan, unmaps dead clients' */
+static void
+scan(bool clean)
+{
+    for (int i = 0; i < nclients; ++i) {
+        clients[i].seen = false;
+    }
+
+    DIR *dir = opendir(SHM_DIR);
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, METRICS_NAME_PREFIX,
+                    strlen(METRICS_NAME_PREFIX)) != 0) {
+            continue;
+        }
+        int i;
+        for (i = 0; i < nclients; ++i) {
+            if (strcmp(clients[i].name, entry->d_name) == 0) {
+                break;
+            }
+        }
+        if (i < nclients) {
+            clients[i].seen = true;
+            continue;
+        }
+
+        if (nclients == clients_size) {
+            int size = clients_size ? clients_size * 2 : 64;
+            struct client *grown = realloc(clients, size * sizeof(*clients));
+            if (grown == NULL) {
+                /* Try again next scan, the ones we have still work */
+                continue;
+            }
+            clients = grown;
+            clients_size = size;
+        }
+        const struct metrics_page *page = map_page(entry->d_name);
+        if (page == NULL) {
+            continue;
+        }
+        struct client *client = &clients[nclients++];
+        memset(client, 0, sizeof(*client));
+        snprintf(client->name, sizeof(client->name), "%s", entry->d_name);
+        client->page = page;
+        client->last_ns = page->start_ns;
+        client->seen = true;
+    }
+    closedir(dir);
+
+    for (int i = 0; i < nclients; ) {
+        bool alive = kill(clients[i].page->pid, 0) == 0 || errno == EPERM;
+        if (clients[i].seen && alive) {
+            ++i;
+            continue;
+        }
+        if (clients[i].seen && clean) {
+            char name[sizeof(clients[i].name) + 1];
+            snprintf(name, sizeof(name), "/%s", clients[i].name);
+            shm_unlink(name);
+        }
+        drop_client(i);
+    }
+}
+
+static double
+rate(const struct client *client, const struct metrics_snapshot *now,
+        enum metrics_value value, double seconds)
+{
+    return seconds > 0
+        ? (now->values[value] - client->last.values[value]) / seconds : 0;
+}
+
+static void
+sample(void)
+{
+    printf("%8s %7s %6s %6s %6s %8s %8s %7s %7s %7s %7s %9s %8s %5s\n",
+            "pid", "fps", "late", "missed", "skip", "ptr/s", "motion/s",
+            "btn/s", "axis/s", "key/s", "touch/s", "release/s",
+            "shm MiB", "busy");
+    for (int i = 0; i < nclients; ++i) {
+        struct client *client = &clients[i];
+        struct metrics_snapshot now;
+        if (metrics_snapshot(client->page, &now) < 0) {
+            printf("%8d busy, skipped\n", client->page->pid);
+            continue;
+        }
+        uint64_t ns = now_ns();
+        double seconds = (ns - client->last_ns) / 1e9;
+        const uint64_t *v = now.values;
+        printf("%8d %7.1f %6llu %6llu %6llu %8.1f %8.1f %7.1f %7.1f %7.1f "
+                "%7.1f %9.1f %8.1f %2llu/%-2llu\n",
+                client->page->pid,
+                rate(client, &now, METRICS_FRAMES, seconds),
+                (unsigned long long)v[METRICS_LATE_FRAMES],
+                (unsigned long long)v[METRICS_MISSED_REFRESHES],
+                (unsigned long long)v[METRICS_SKIPPED_REFRESHES],
+                rate(client, &now, METRICS_POINTER_FRAMES, seconds),
+                rate(client, &now, METRICS_POINTER_MOTIONS, seconds),
+                rate(client, &now, METRICS_POINTER_BUTTONS, seconds),
+                rate(client, &now, METRICS_POINTER_AXES, seconds),
+                rate(client, &now, METRICS_KEYS, seconds),
+                rate(client, &now, METRICS_TOUCH_FRAMES, seconds),
+                rate(client, &now, METRICS_BUFFER_RELEASES, seconds),
+                v[METRICS_SHM_BYTES] / 1048576.0,
+                (unsigned long long)v[METRICS_POOL_BUSY],
+                (unsigned long long)v[METRICS_POOL_BUFFERS]);
+        client->last = now;
+        client->last_ns = ns;
+    }
+    fflush(stdout);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long interval_ms = 1000, count = 1;
+    bool clean = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:c")) != -1) {
+        switch (opt) {
+        case 'i':
+            interval_ms = strtol(optarg, NULL, 10);
+            break;
+        case 'n':
+            count = strtol(optarg, NULL, 10);
+            break;
+        case 'c':
+            clean = true;
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc || interval_ms <= 0) {
+        goto usage;
+    }
+
+    for (long i = 0; count == 0 || i < count; ++i) {
+        if (i > 0) {
+            struct timespec delay = {
+                interval_ms / 1000, interval_ms % 1000 * 1000000,
+            };
+            nanosleep(&delay, NULL);
+        }
+        scan(clean);
+        sample();
+    }
+
+    while (nclients > 0) {
+        drop_client(nclients - 1);
+    }
+    free(clients);
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: %s [-i MS] [-n COUNT] [-c]\n", argv[0]);
+    return 2;
+}
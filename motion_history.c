@@ -0,0 +1,135 @@
+#include "frame_stats.h"
+#include "motion_history.h"
+
+_Static_assert((MOTION_HISTORY_CAPACITY & (MOTION_HISTORY_CAPACITY - 1))
+        == 0, "ring size must be a power of two");
+
+static const struct motion_sample *
+sample_at(const struct motion_history *history, uint64_t index)
+{
+    return &history->samples[index & (MOTION_HISTORY_CAPACITY - 1)];
+}
+
+/* Index of the oldest sample not yet overwritten */
+static uint64_t
+oldest_kept(const struct motion_history *history)
+{
+    return history->head > MOTION_HISTORY_CAPACITY
+        ? history->head - MOTION_HISTORY_CAPACITY : 0;
+}
+
+/* Everything from index first up to the newest */
+static void
+span_from(const struct motion_history *history, uint64_t first,
+        struct motion_span *span)
+{
+    size_t count = history->head - first;
+    size_t start = first & (MOTION_HISTORY_CAPACITY - 1);
+    size_t run = MOTION_HISTORY_CAPACITY - start;
+    if (run > count) {
+        run = count;
+    }
+    span->samples[0] = &history->samples[start];
+    span->count[0] = run;
+    span->samples[1] = history->samples;
+    span->count[1] = count - run;
+}
+
+void
+motion_history_init(struct motion_history *history)
+{
+    history->head = 0;
+    history->taken = 0;
+    history->dropped = 0;
+}
+
+void
+motion_history_push(struct motion_history *history, wl_fixed_t x,
+        wl_fixed_t y, uint32_t time, uint32_t flags)
+{
+    uint64_t head = history->head;
+    if (head - history->taken == MOTION_HISTORY_CAPACITY) {
+        /* The oldest sample nobody took yet goes */
+        ++history->taken;
+        ++history->dropped;
+    }
+    struct motion_sample *sample =
+        &history->samples[head & (MOTION_HISTORY_CAPACITY - 1)];
+    sample->x = x;
+    sample->y = y;
+    sample->time = time;
+    sample->flags = flags;
+    sample->ns = frame_stats_now();
+    history->head = head + 1;
+}
+
+bool
+motion_history_latest(const struct motion_history *history,
+        struct motion_sample *sample)
+{
+    if (history->head == 0) {
+        return false;
+    }
+    *sample = *sample_at(history, history->head - 1);
+    return true;
+}
+
+size_t
+motion_history_take(struct motion_history *history, struct motion_span *span)
+{
+    size_t count = history->head - history->taken;
+    if (span != NULL) {
+        span_from(history, history->taken, span);
+    }
+    history->taken = history->head;
+    return count;
+}
+
+size_t
+motion_history_recent(const struct motion_history *history,
+        uint64_t since_ns, struct motion_span *span)
+{
+    uint64_t oldest = oldest_kept(history);
+    uint64_t first = history->head;
+    while (first > oldest) {
+        const struct motion_sample *sample = sample_at(history, first - 1);
+        if (sample->ns < since_ns) {
+            break;
+        }
+        --first;
+        if (sample->flags & MOTION_SAMPLE_ENTER) {
+            break;
+        }
+    }
+    span_from(history, first, span);
+    return history->head - first;
+}
+
+bool
+motion_history_at(const struct motion_history *history, uint64_t ns,
+        double *x, double *y)
+{
+    if (history->head == 0
+            || sample_at(history, history->head - 1)->ns <= ns) {
+        return false;
+    }
+    uint64_t oldest = oldest_kept(history);
+    for (uint64_t i = history->head - 1; i > oldest; --i) {
+        const struct motion_sample *before = sample_at(history, i - 1);
+        if (before->ns > ns) {
+            continue;
+        }
+        const struct motion_sample *after = sample_at(history, i);
+        double bx = wl_fixed_to_double(before->x);
+        double by = wl_fixed_to_double(before->y);
+        /* Outside the surface in between, it was where it left */
+        double t = 0;
+        if (!(after->flags & MOTION_SAMPLE_ENTER) && after->ns > before->ns) {
+            t = (double)(ns - before->ns) / (after->ns - before->ns);
+        }
+        *x = bx + t * (wl_fixed_to_double(after->x) - bx);
+        *y = by + t * (wl_fixed_to_double(after->y) - by);
+        return true;
+    }
+    return false;
+}
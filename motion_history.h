@@ -0,0 +1,81 @@
+#ifndef MOTION_HISTORY_H
+#define MOTION_HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-client.h>
+
+/*
+ * Samples kept between two frames, a power of two. An 8 kHz mouse fills
+ * it in 64 ms, so frames down to about 16 Hz see every sample.
+ */
+#define MOTION_HISTORY_CAPACITY 512
+
+/* The pointer entered the surface here, a stroke must not join across it */
+#define MOTION_SAMPLE_ENTER (1 << 0)
+
+struct motion_sample {
+    wl_fixed_t x, y;
+    /* The event's Wayland timestamp in ms */
+    uint32_t time;
+    uint32_t flags;
+    /* CLOCK_MONOTONIC on arrival, what tells apart samples in one ms */
+    uint64_t ns;
+};
+
+/* Up to two runs of the ring, oldest first */
+struct motion_span {
+    const struct motion_sample *samples[2];
+    size_t count[2];
+};
+
+/*
+ * Every pointer position, in a fixed ring, so the input rate costs one
+ * store per event and each frame looks at what arrived since the last one
+ * in one go: either just the latest position or the whole list, e.g. to
+ * draw a stroke through all of them.
+ */
+struct motion_history {
+    /* Samples ever pushed, the newest CAPACITY of them are kept */
+    uint64_t head;
+    /* Samples handed out by motion_history_take() */
+    uint64_t taken;
+    /* Overwritten before anything took them */
+    uint64_t dropped;
+    struct motion_sample samples[MOTION_HISTORY_CAPACITY];
+};
+
+void motion_history_init(struct motion_history *history);
+
+void motion_history_push(struct motion_history *history, wl_fixed_t x,
+        wl_fixed_t y, uint32_t time, uint32_t flags);
+
+/* The coalesced position: the newest sample, taken or not */
+bool motion_history_latest(const struct motion_history *history,
+        struct motion_sample *sample);
+
+/*
+ * Hands out every sample since the last take and returns how many. The
+ * span points into the ring and holds until the next push; with a NULL
+ * span the samples are only marked as taken.
+ */
+size_t motion_history_take(struct motion_history *history,
+        struct motion_span *span);
+
+/*
+ * The samples still in the ring from since_ns on, taken or not, back to
+ * the last one that entered the surface. Holds until the next push.
+ */
+size_t motion_history_recent(const struct motion_history *history,
+        uint64_t since_ns, struct motion_span *span);
+
+/*
+ * Where the pointer was at ns, interpolated between the samples around
+ * it. False if no sample after ns arrived yet, or the ones before it are
+ * gone from the ring.
+ */
+bool motion_history_at(const struct motion_history *history, uint64_t ns,
+        double *x, double *y);
+
+#endif
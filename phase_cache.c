@@ -0,0 +1,47 @@
+#include <stddef.h>
+#include <string.h>
+#include "phase_cache.h"
+#include "render.h"
+
+void
+phase_cache_init(struct phase_cache *cache, struct wl_shm *wl_shm,
+        int shm_flags)
+{
+    buffer_pool_init(&cache->pool, wl_shm, PHASE_CACHE_PHASES, shm_flags);
+    memset(cache->filled, 0, sizeof(cache->filled));
+}
+
+void
+phase_cache_finish(struct phase_cache *cache)
+{
+    buffer_pool_finish(&cache->pool);
+    memset(cache->filled, 0, sizeof(cache->filled));
+}
+
+void
+phase_cache_invalidate(struct phase_cache *cache)
+{
+    memset(cache->filled, 0, sizeof(cache->filled));
+}
+
+struct pool_buffer *
+phase_cache_get(struct phase_cache *cache, int width, int height, int phase)
+{
+    struct buffer_pool *pool = &cache->pool;
+    size_t size = (size_t)width * 4 * height * PHASE_CACHE_PHASES;
+    if (size > PHASE_CACHE_MAX_SIZE)
+        return NULL;
+
+    if (width != pool->width || height != pool->height) {
+        phase_cache_invalidate(cache);
+        if (!buffer_pool_resize(pool, width, height))
+            return NULL;
+    }
+
+    struct pool_buffer *buffer = &pool->slots[phase];
+    if (!cache->filled[phase]) {
+        render_checkerboard(buffer->data, width, height, pool->stride, phase);
+        cache->filled[phase] = true;
+    }
+    return buffer;
+}
@@ -0,0 +1,39 @@
+#ifndef PHASE_CACHE_H
+#define PHASE_CACHE_H
+
+#include <stdbool.h>
+#include <wayland-client.h>
+#include "buffer_pool.h"
+
+/* (int)offset % 8: the checkerboard only has this many distinct frames */
+#define PHASE_CACHE_PHASES 8
+
+/* Beyond this the cache costs more memory than re-rendering is worth */
+#define PHASE_CACHE_MAX_SIZE (256 << 20)
+
+/*
+ * Pre-rendered checkerboard frames, one pool slot per scroll phase. The
+ * contents never change once filled, so a buffer can be attached again
+ * while the compositor still holds it.
+ */
+struct phase_cache {
+    struct buffer_pool pool;
+    bool filled[PHASE_CACHE_PHASES];
+};
+
+void phase_cache_init(struct phase_cache *cache, struct wl_shm *wl_shm,
+        int shm_flags);
+void phase_cache_finish(struct phase_cache *cache);
+
+/* Drops every cached frame, e.g. when the surface size changes */
+void phase_cache_invalidate(struct phase_cache *cache);
+
+/*
+ * Returns the frame for this phase, rendering it on first use. Returns NULL
+ * if the surface is too large to cache or allocation failed. Whoever
+ * attaches it marks it busy, so a resize knows to defer destroying it.
+ */
+struct pool_buffer *phase_cache_get(struct phase_cache *cache,
+        int width, int height, int phase);
+
+#endif
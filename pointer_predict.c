@@ -0,0 +1,173 @@
+#include <math.h>
+#include <string.h>
+#include "pointer_predict.h"
+
+void
+pointer_predict_init(struct pointer_predict *predict, uint64_t horizon_ns)
+{
+    memset(predict, 0, sizeof(*predict));
+    predict->horizon_ns = horizon_ns;
+}
+
+/*
+ * Seconds from the newest sample back to sample. Times are the events' own:
+ * arrival bunches up whatever sat in the socket while we were busy. An
+ * enter has none, only its arrival to go by.
+ */
+static double
+sample_age(const struct motion_sample *sample,
+        const struct motion_sample *latest)
+{
+    if ((sample->flags | latest->flags) & MOTION_SAMPLE_ENTER) {
+        return -(double)(latest->ns - sample->ns) / 1e9;
+    }
+    return (int32_t)(sample->time - latest->time) / 1e3;
+}
+
+/* Least-squares velocity in px/s through the recent samples, 0 if too few */
+static void
+fit_velocity(const struct motion_history *history,
+        const struct motion_sample *latest, double *vx, double *vy)
+{
+    struct motion_span span;
+    motion_history_recent(history,
+            latest->ns - POINTER_PREDICT_WINDOW_NS, &span);
+    *vx = *vy = 0;
+
+    /* Relative to the newest sample, in seconds, to keep the sums small */
+    double st = 0, sx = 0, sy = 0, stt = 0, stx = 0, sty = 0;
+    double oldest = 0;
+    size_t n = 0;
+    for (int run = 0; run < 2; ++run) {
+        for (size_t i = 0; i < span.count[run]; ++i) {
+            const struct motion_sample *sample = &span.samples[run][i];
+            if (sample->flags & MOTION_SAMPLE_ENTER) {
+                /* Where it was before it left has nothing to do with this */
+                st = sx = sy = stt = stx = sty = 0;
+                oldest = 0;
+                n = 0;
+            }
+            double t = sample_age(sample, latest);
+            double x = wl_fixed_to_double(sample->x);
+            double y = wl_fixed_to_double(sample->y);
+            if (t < oldest) {
+                oldest = t;
+            }
+            st += t;
+            sx += x;
+            sy += y;
+            stt += t * t;
+            stx += t * x;
+            sty += t * y;
+            ++n;
+        }
+    }
+    if (n < 2) {
+        return;
+    }
+    /* Within a few ms of each other, the slope is mostly rounding */
+    if (-oldest < POINTER_PREDICT_MIN_SPAN_MS / 1e3) {
+        return;
+    }
+    double denominator = n * stt - st * st;
+    *vx = (n * stx - st * sx) / denominator;
+    *vy = (n * sty - st * sy) / denominator;
+}
+
+static void
+record_error(struct frame_histogram *histogram, double dx, double dy)
+{
+    frame_histogram_record(histogram, (uint64_t)(hypot(dx, dy) * 1000));
+}
+
+/* Scores the predictions whose time the pointer has got to */
+static void
+score_pending(struct pointer_predict *predict,
+        const struct motion_history *history)
+{
+    struct motion_sample latest;
+    bool have_latest = motion_history_latest(history, &latest);
+    uint64_t now = frame_stats_now();
+
+    unsigned kept = 0;
+    for (unsigned i = 0; i < predict->npending; ++i) {
+        const struct pointer_predict_pending *pending = &predict->pending[i];
+        double x, y;
+        if (!motion_history_at(history, pending->target_ns, &x, &y)) {
+            if (have_latest && latest.ns > pending->target_ns) {
+                /* The samples around it are gone, nothing to score */
+                continue;
+            }
+            if (!have_latest
+                    || now < pending->target_ns + POINTER_PREDICT_WINDOW_NS) {
+                predict->pending[kept++] = *pending;
+                continue;
+            }
+            /* Nothing since: it stood still where it last was */
+            x = wl_fixed_to_double(latest.x);
+            y = wl_fixed_to_double(latest.y);
+        }
+        record_error(&predict->error, pending->x - x, pending->y - y);
+        record_error(&predict->latest_error,
+                pending->latest_x - x, pending->latest_y - y);
+    }
+    predict->npending = kept;
+}
+
+void
+pointer_predict(struct pointer_predict *predict,
+        const struct motion_history *history, uint64_t target_ns,
+        struct pointer_prediction *prediction)
+{
+    score_pending(predict, history);
+
+    struct motion_sample latest;
+    if (!motion_history_latest(history, &latest)) {
+        prediction->valid = false;
+        return;
+    }
+    double x = wl_fixed_to_double(latest.x);
+    double y = wl_fixed_to_double(latest.y);
+    prediction->valid = true;
+    prediction->target_ns = target_ns;
+    prediction->x = x;
+    prediction->y = y;
+
+    /* A pointer that stopped a while ago stays where it is */
+    uint64_t now = frame_stats_now();
+    if (predict->horizon_ns > 0 && target_ns > latest.ns
+            && now - latest.ns < POINTER_PREDICT_WINDOW_NS) {
+        double vx, vy;
+        fit_velocity(history, &latest, &vx, &vy);
+        uint64_t ahead = target_ns - latest.ns;
+        if (ahead > predict->horizon_ns) {
+            ahead = predict->horizon_ns;
+        }
+        prediction->x += vx * ahead / 1e9;
+        prediction->y += vy * ahead / 1e9;
+    }
+
+    if (predict->npending == POINTER_PREDICT_PENDING) {
+        /* The oldest never got scored, make room */
+        memmove(&predict->pending[0], &predict->pending[1],
+                (POINTER_PREDICT_PENDING - 1) * sizeof(predict->pending[0]));
+        --predict->npending;
+    }
+    predict->pending[predict->npending++] = (struct pointer_predict_pending){
+        .target_ns = target_ns,
+        .x = prediction->x,
+        .y = prediction->y,
+        .latest_x = x,
+        .latest_y = y,
+    };
+}
+
+void
+pointer_predict_report(const struct pointer_predict *predict, FILE *out)
+{
+    fprintf(out, "pointer error at presentation, px (horizon %.1f ms):\n",
+            predict->horizon_ns / 1e6);
+    fprintf(out, FRAME_HISTOGRAM_HEADER, "position");
+    frame_histogram_report_scaled(&predict->error, "predict", 1e3, out);
+    frame_histogram_report_scaled(&predict->latest_error, "latest", 1e3, out);
+}
@@ -0,0 +1,71 @@
+#ifndef POINTER_PREDICT_H
+#define POINTER_PREDICT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "frame_stats.h"
+#include "motion_history.h"
+
+/* How far back the velocity fit looks */
+#define POINTER_PREDICT_WINDOW_NS 40000000ULL
+
+/* Shortest stretch of event time the velocity is fitted over */
+#define POINTER_PREDICT_MIN_SPAN_MS 4
+
+/* Predictions waiting for the pointer to get to their time */
+#define POINTER_PREDICT_PENDING 16
+
+struct pointer_prediction {
+    bool valid;
+    /* Surface coordinates */
+    double x, y;
+    /* CLOCK_MONOTONIC the position is for */
+    uint64_t target_ns;
+};
+
+struct pointer_predict_pending {
+    uint64_t target_ns;
+    double x, y;
+    /* The newest sample when predicting, what we'd show without */
+    double latest_x, latest_y;
+};
+
+/*
+ * Extrapolates the pointer to when the frame being rendered will be
+ * shown, so content that follows it doesn't trail by the frames between
+ * input and display.
+ *
+ * The velocity is a least-squares line through the samples that arrived
+ * in the last POINTER_PREDICT_WINDOW_NS, against their event times, or
+ * their arrival for an enter, which has none. The prediction carries on
+ * from the newest sample along it, never more than horizon_ns past it.
+ * Once the pointer gets to a prediction's time, the error is recorded, as
+ * is the error of the newest sample alone, to see what prediction buys.
+ */
+struct pointer_predict {
+    /* 0 turns prediction off, the errors are still measured */
+    uint64_t horizon_ns;
+
+    struct pointer_predict_pending pending[POINTER_PREDICT_PENDING];
+    unsigned npending;
+    /* In 1/1000 px */
+    struct frame_histogram error;
+    struct frame_histogram latest_error;
+};
+
+void pointer_predict_init(struct pointer_predict *predict,
+        uint64_t horizon_ns);
+
+/*
+ * Where the pointer will be at target_ns, from history; invalid if the
+ * pointer never was on the surface.
+ */
+void pointer_predict(struct pointer_predict *predict,
+        const struct motion_history *history, uint64_t target_ns,
+        struct pointer_prediction *prediction);
+
+void pointer_predict_report(const struct pointer_predict *predict,
+        FILE *out);
+
+#endif
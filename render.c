@@ -0,0 +1,122 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "render.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#define CHECKER_DARK 0xFF666666
+#define CHECKER_LIGHT 0xFFEEEEEE
+/* Squares are 8 pixels wide, so the pattern repeats every 16 pixels */
+#define CHECKER_PERIOD 16
+
+typedef void (*fill_row_func)(uint32_t *row, int width,
+        const uint32_t *period);
+
+static void
+fill_row_scalar(uint32_t *row, int width, const uint32_t *period)
+{
+    for (int x = 0; x < width; ++x)
+        row[x] = period[x % CHECKER_PERIOD];
+}
+
+#if defined(__SSE2__)
+static void
+fill_row_sse2(uint32_t *row, int width, const uint32_t *period)
+{
+    __m128i p0 = _mm_loadu_si128((const __m128i *)&period[0]);
+    __m128i p1 = _mm_loadu_si128((const __m128i *)&period[4]);
+    __m128i p2 = _mm_loadu_si128((const __m128i *)&period[8]);
+    __m128i p3 = _mm_loadu_si128((const __m128i *)&period[12]);
+    int x = 0;
+    for (; x + CHECKER_PERIOD <= width; x += CHECKER_PERIOD) {
+        _mm_storeu_si128((__m128i *)&row[x], p0);
+        _mm_storeu_si128((__m128i *)&row[x + 4], p1);
+        _mm_storeu_si128((__m128i *)&row[x + 8], p2);
+        _mm_storeu_si128((__m128i *)&row[x + 12], p3);
+    }
+    for (; x < width; ++x)
+        row[x] = period[x % CHECKER_PERIOD];
+}
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static void
+fill_row_avx2(uint32_t *row, int width, const uint32_t *period)
+{
+    __m256i p0 = _mm256_loadu_si256((const __m256i *)&period[0]);
+    __m256i p1 = _mm256_loadu_si256((const __m256i *)&period[8]);
+    int x = 0;
+    for (; x + CHECKER_PERIOD <= width; x += CHECKER_PERIOD) {
+        _mm256_storeu_si256((__m256i *)&row[x], p0);
+        _mm256_storeu_si256((__m256i *)&row[x + 8], p1);
+    }
+    for (; x < width; ++x)
+        row[x] = period[x % CHECKER_PERIOD];
+}
+#endif
+
+/* Chosen once, whichever render worker gets there first */
+static fill_row_func fill_row;
+static pthread_once_t fill_row_once = PTHREAD_ONCE_INIT;
+
+static void
+select_fill_row(void)
+{
+    fill_row_func selected = fill_row_scalar;
+#if defined(__SSE2__)
+    selected = fill_row_sse2;
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        selected = fill_row_avx2;
+#endif
+    fill_row = selected;
+}
+
+void
+render_checkerboard_region(uint32_t *data, int stride, int offset,
+        int x, int y, int width, int height)
+{
+    /*
+     * A pixel is dark when ((x + offset) + (y + offset) / 8 * 8) % 16 < 8.
+     * Every row is therefore one of two kinds, selected by the parity of
+     * its 8-row band, and each kind is a 16 pixel period shifted by offset.
+     * Build each kind once and copy it down the rest of the region.
+     */
+    pthread_once(&fill_row_once, select_fill_row);
+    /* Two periods back to back so the region can start mid-period */
+    uint32_t period[2][CHECKER_PERIOD * 2];
+    for (int i = 0; i < CHECKER_PERIOD * 2; ++i) {
+        bool dark = (i + offset) % CHECKER_PERIOD < 8;
+        period[0][i] = dark ? CHECKER_DARK : CHECKER_LIGHT;
+        period[1][i] = dark ? CHECKER_LIGHT : CHECKER_DARK;
+    }
+
+    const uint32_t *rows[2] = { NULL, NULL };
+    size_t row_size = (size_t)width * sizeof(uint32_t);
+    for (int j = y; j < y + height; ++j) {
+        uint32_t *row = (uint32_t *)((char *)data + (size_t)j * stride) + x;
+        int kind = ((j + offset) / 8) & 1;
+        if (rows[kind] == NULL) {
+            fill_row(row, width, &period[kind][x % CHECKER_PERIOD]);
+            rows[kind] = row;
+        } else {
+            memcpy(row, rows[kind], row_size);
+        }
+    }
+}
+
+void
+render_checkerboard(uint32_t *data, int width, int height, int stride,
+        int offset)
+{
+    render_checkerboard_region(data, stride, offset, 0, 0, width, height);
+}
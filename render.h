@@ -0,0 +1,17 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <stdint.h>
+
+/*
+ * Draw the scrolling checkerboard into an XRGB8888 buffer. stride is in
+ * bytes, offset is the scroll phase in pixels.
+ */
+void render_checkerboard(uint32_t *data, int width, int height, int stride,
+        int offset);
+
+/* Same pattern, limited to one rectangle of the buffer */
+void render_checkerboard_region(uint32_t *data, int stride, int offset,
+        int x, int y, int width, int height);
+
+#endif
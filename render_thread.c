@@ -0,0 +1,120 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include "render_thread.h"
+
+struct render_thread {
+    pthread_t thread;
+    render_thread_func paint;
+    /* Posted once per submitted job, and once more to quit */
+    sem_t start;
+    /* Posted after a job is published, only used to block in wait() */
+    sem_t done;
+    void *job;
+    bool quit;
+    /* The SPSC ready slot: written by the render thread, emptied by us */
+    _Atomic(void *) ready;
+    bool pending;
+};
+
+static void *
+render_thread_main(void *data)
+{
+    struct render_thread *thread = data;
+    pthread_setname_np(pthread_self(), "wl-render");
+    for (;;) {
+        while (sem_wait(&thread->start) < 0 && errno == EINTR)
+            ;
+        /* job and quit were written before the post */
+        if (thread->quit)
+            break;
+        void *job = thread->job;
+        thread->paint(job);
+        atomic_store_explicit(&thread->ready, job, memory_order_release);
+        sem_post(&thread->done);
+    }
+    return NULL;
+}
+
+struct render_thread *
+render_thread_create(render_thread_func paint)
+{
+    struct render_thread *thread = calloc(1, sizeof(*thread));
+    if (thread == NULL)
+        return NULL;
+    thread->paint = paint;
+    atomic_init(&thread->ready, NULL);
+    sem_init(&thread->start, 0, 0);
+    sem_init(&thread->done, 0, 0);
+    if (pthread_create(&thread->thread, NULL,
+                render_thread_main, thread) != 0) {
+        sem_destroy(&thread->done);
+        sem_destroy(&thread->start);
+        free(thread);
+        return NULL;
+    }
+    return thread;
+}
+
+void
+render_thread_destroy(struct render_thread *thread)
+{
+    if (thread == NULL)
+        return;
+    render_thread_wait(thread);
+    thread->quit = true;
+    sem_post(&thread->start);
+    pthread_join(thread->thread, NULL);
+    sem_destroy(&thread->done);
+    sem_destroy(&thread->start);
+    free(thread);
+}
+
+bool
+render_thread_pending(const struct render_thread *thread)
+{
+    return thread->pending;
+}
+
+void
+render_thread_submit(struct render_thread *thread, void *job)
+{
+    thread->job = job;
+    thread->pending = true;
+    sem_post(&thread->start);
+}
+
+void *
+render_thread_take(struct render_thread *thread)
+{
+    if (!thread->pending)
+        return NULL;
+    void *job = atomic_exchange_explicit(&thread->ready, NULL,
+            memory_order_acquire);
+    if (job == NULL)
+        return NULL;
+    thread->pending = false;
+    /*
+     * Usually the render thread has posted by now. If not, the token is
+     * left over and the loop in render_thread_wait() skips it later.
+     */
+    sem_trywait(&thread->done);
+    return job;
+}
+
+void *
+render_thread_wait(struct render_thread *thread)
+{
+    while (thread->pending) {
+        void *job = render_thread_take(thread);
+        if (job != NULL)
+            return job;
+        sem_wait(&thread->done);
+    }
+    return NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef RENDER_THREAD_H
+#define RENDER_THREAD_H
+
+#include <stdbool.h>
+
+/* Does the pixel work for one job, on the render thread */
+typedef void (*render_thread_func)(void *job);
+
+/*
+ * A thread that paints one job at a time ahead of the Wayland thread. The
+ * finished job is published through a single-producer single-consumer slot
+ * that the Wayland thread polls without taking any lock.
+ *
+ * Only the Wayland thread calls these functions.
+ */
+struct render_thread;
+
+struct render_thread *render_thread_create(render_thread_func paint);
+void render_thread_destroy(struct render_thread *thread);
+
+/* True between render_thread_submit() and getting the job back */
+bool render_thread_pending(const struct render_thread *thread);
+
+/* Hands a job to the render thread, which must not have one pending */
+void render_thread_submit(struct render_thread *thread, void *job);
+
+/* Returns the finished job, or NULL if it is not done (or none pending) */
+void *render_thread_take(struct render_thread *thread);
+
+/* Blocks until the pending job is done and returns it, NULL if none */
+void *render_thread_wait(struct render_thread *thread);
+
+#endif
@@ -0,0 +1,119 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "shm.h"
+
+struct shm_backend {
+    const char *name;
+    /* Returns an empty file, or -1 with errno set */
+    int (*create)(int flags);
+    bool sealable;
+};
+
+#ifdef MFD_CLOEXEC
+static int
+create_memfd(int flags)
+{
+    unsigned int mfd_flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+#ifdef MFD_HUGETLB
+    if (flags & SHM_HUGEPAGES)
+        mfd_flags |= MFD_HUGETLB;
+#endif
+    return memfd_create("wl_shm", mfd_flags);
+}
+#endif
+
+static void
+randname(char *buf)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long r = ts.tv_nsec;
+    for (int i = 0; i < 6; ++i) {
+        buf[i] = 'A'+(r&15)+(r&16)*2;
+        r >>= 5;
+    }
+}
+
+static int
+create_shm_file(int flags)
+{
+    int retries = 100;
+    do {
+        char name[] = "/wl_shm-XXXXXX";
+        randname(name + sizeof(name) - 7);
+        --retries;
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            shm_unlink(name);
+            return fd;
+        }
+    } while (retries > 0 && errno == EEXIST);
+    return -1;
+}
+
+/* Tried in order; later entries are only used when earlier ones fail */
+static const struct shm_backend shm_backends[] = {
+#ifdef MFD_CLOEXEC
+    { "memfd", create_memfd, true },
+#endif
+    { "shm_open", create_shm_file, false },
+};
+
+int
+resize_shm_file(int fd, size_t size)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return -1;
+    /* hugetlbfs reports the huge page size here and rejects partial pages */
+    size_t align = st.st_blksize > 0 ? (size_t)st.st_blksize : 1;
+    size = (size + align - 1) / align * align;
+
+    int ret;
+    do {
+        ret = ftruncate(fd, size);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+size_t
+shm_file_size(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return 0;
+    return st.st_size;
+}
+
+int
+allocate_shm_file(size_t size, int flags)
+{
+    const size_t nbackends = sizeof(shm_backends) / sizeof(shm_backends[0]);
+    for (size_t i = 0; i < nbackends; ++i) {
+        const struct shm_backend *backend = &shm_backends[i];
+        int fd = backend->create(flags);
+        if (fd < 0)
+            continue;
+        if (resize_shm_file(fd, size) < 0) {
+            close(fd);
+            continue;
+        }
+#ifdef F_SEAL_SHRINK
+        /*
+         * The compositor maps this file too; forbid shrinking it under its
+         * feet. Growing stays allowed so the pool can be resized in place.
+         */
+        if (backend->sealable)
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+#endif
+        return fd;
+    }
+    return -1;
+}
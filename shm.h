@@ -0,0 +1,20 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include <stddef.h>
+
+/* Back the file with huge pages when the backend supports it */
+#define SHM_HUGEPAGES (1 << 0)
+
+/*
+ * Pools smaller than this gain nothing from huge pages, a 4K surface is
+ * 32 MiB per buffer.
+ */
+#define SHM_HUGEPAGE_THRESHOLD (16 << 20)
+
+/* Shared memory support code */
+int allocate_shm_file(size_t size, int flags);
+int resize_shm_file(int fd, size_t size);
+size_t shm_file_size(int fd);
+
+#endif
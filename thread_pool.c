@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "thread_pool.h"
+
+/* Used when sysconf cannot tell us */
+#define DEFAULT_L2_SIZE (256 * 1024)
+
+/* One per participant, on its own cache line so stealing doesn't bounce */
+struct work_queue {
+    _Alignas(64) atomic_int next;
+    int end;
+};
+
+struct thread_pool {
+    int nworkers;
+    pthread_t threads[THREAD_POOL_MAX_WORKERS];
+    size_t l2_size;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int running;
+    bool quit;
+
+    /* The job in flight, written under lock before workers are woken */
+    thread_pool_func func;
+    void *data;
+    /* Workers use queues[0..nworkers-1], the submitting thread the last */
+    struct work_queue queues[THREAD_POOL_MAX_WORKERS + 1];
+};
+
+struct worker {
+    struct thread_pool *pool;
+    int index;
+};
+
+static void
+do_work(struct thread_pool *pool, int self)
+{
+    int nqueues = pool->nworkers + 1;
+    /* Drain our own queue first, then steal from the others in turn */
+    for (int k = 0; k < nqueues; ++k) {
+        struct work_queue *queue = &pool->queues[(self + k) % nqueues];
+        for (;;) {
+            int i = atomic_fetch_add_explicit(&queue->next, 1,
+                    memory_order_relaxed);
+            if (i >= queue->end)
+                break;
+            pool->func(pool->data, i);
+        }
+    }
+}
+
+static void *
+worker_main(void *data)
+{
+    struct worker *worker = data;
+    struct thread_pool *pool = worker->pool;
+    int index = worker->index;
+    free(worker);
+
+    char name[16];
+    snprintf(name, sizeof(name), "wl-worker-%d", index);
+    pthread_setname_np(pthread_self(), name);
+
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        do_work(pool, index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static size_t
+l2_cache_size(void)
+{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (size > 0)
+        return size;
+#endif
+    return DEFAULT_L2_SIZE;
+}
+
+struct thread_pool *
+thread_pool_create(int nworkers, const int *cpus, int ncpus)
+{
+    struct thread_pool *pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    if (nworkers < 0)
+        nworkers = 0;
+    if (nworkers > THREAD_POOL_MAX_WORKERS)
+        nworkers = THREAD_POOL_MAX_WORKERS;
+    pool->l2_size = l2_cache_size();
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < nworkers; ++i) {
+        struct worker *worker = malloc(sizeof(*worker));
+        if (worker == NULL)
+            break;
+        worker->pool = pool;
+        worker->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, worker) != 0) {
+            free(worker);
+            break;
+        }
+        if (ncpus > 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % ncpus], &set);
+            pthread_setaffinity_np(pool->threads[i], sizeof(set), &set);
+        }
+        pool->nworkers++;
+    }
+    return pool;
+}
+
+void
+thread_pool_destroy(struct thread_pool *pool)
+{
+    if (pool == NULL)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->nworkers; ++i)
+        pthread_join(pool->threads[i], NULL);
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+void
+thread_pool_run(struct thread_pool *pool, int count,
+        thread_pool_func func, void *data)
+{
+    if (pool == NULL || pool->nworkers == 0 || count <= 1) {
+        for (int i = 0; i < count; ++i)
+            func(data, i);
+        return;
+    }
+
+    int nqueues = pool->nworkers + 1;
+    pthread_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->data = data;
+    for (int q = 0; q < nqueues; ++q) {
+        atomic_store_explicit(&pool->queues[q].next,
+                (int)((int64_t)count * q / nqueues), memory_order_relaxed);
+        pool->queues[q].end = (int64_t)count * (q + 1) / nqueues;
+    }
+    pool->running = pool->nworkers;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    do_work(pool, pool->nworkers);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int
+thread_pool_band_rows(const struct thread_pool *pool, size_t row_bytes)
+{
+    size_t l2 = pool != NULL ? pool->l2_size : DEFAULT_L2_SIZE;
+    /* Leave half of L2 for everything else */
+    size_t rows = row_bytes > 0 ? l2 / 2 / row_bytes : 1;
+    return rows > 0 ? (int)rows : 1;
+}
@@ -0,0 +1,32 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+#define THREAD_POOL_MAX_WORKERS 64
+
+/* Called once per item, from any worker or the submitting thread */
+typedef void (*thread_pool_func)(void *data, int index);
+
+struct thread_pool;
+
+/*
+ * Starts nworkers persistent threads. If ncpus > 0, worker i is pinned to
+ * cpus[i % ncpus]. With nworkers == 0 every job runs on the caller.
+ */
+struct thread_pool *thread_pool_create(int nworkers,
+        const int *cpus, int ncpus);
+void thread_pool_destroy(struct thread_pool *pool);
+
+/*
+ * Runs func for every index in [0, count) and returns once all of them are
+ * done. The calling thread works too. Items start out evenly partitioned
+ * and idle threads steal from the others.
+ */
+void thread_pool_run(struct thread_pool *pool, int count,
+        thread_pool_func func, void *data);
+
+/* Rows per band so that one band of this row size stays within L2 */
+int thread_pool_band_rows(const struct thread_pool *pool, size_t row_bytes);
+
+#endif
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <string.h>
+#include "touch_table.h"
+
+static uint32_t
+home_bucket(const struct touch_table *table, int32_t id)
+{
+    /* Ids are usually small and consecutive, spread them out */
+    uint32_t hash = (uint32_t)id * 0x9e3779b1u;
+    return (hash ^ hash >> 16) & (table->nbuckets - 1);
+}
+
+/* The bucket holding id, or the empty one where it would go */
+static uint32_t
+probe(const struct touch_table *table, int32_t id)
+{
+    uint32_t mask = table->nbuckets - 1;
+    uint32_t bucket = home_bucket(table, id);
+    while (table->buckets[bucket].index >= 0
+            && table->buckets[bucket].id != id) {
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+/* Empties a bucket, shifting back the ones probed past it */
+static void
+remove_bucket(struct touch_table *table, uint32_t hole)
+{
+    uint32_t mask = table->nbuckets - 1;
+    uint32_t next = hole;
+    for (;;) {
+        next = (next + 1) & mask;
+        if (table->buckets[next].index < 0) {
+            break;
+        }
+        /* Moving it back is fine unless its home lies after the hole */
+        uint32_t home = home_bucket(table, table->buckets[next].id);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table->buckets[hole] = table->buckets[next];
+            hole = next;
+        }
+    }
+    table->buckets[hole].index = -1;
+}
+
+static void
+clear_buckets(struct touch_table *table)
+{
+    for (uint32_t i = 0; i < table->nbuckets; ++i) {
+        table->buckets[i].index = -1;
+    }
+}
+
+int
+touch_table_init(struct touch_table *table, uint32_t capacity)
+{
+    memset(table, 0, sizeof(*table));
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    table->capacity = capacity;
+    table->nbuckets = 2;
+    while (table->nbuckets < 2 * capacity) {
+        table->nbuckets *= 2;
+    }
+
+    table->id = calloc(capacity, sizeof(*table->id));
+    table->event_mask = calloc(capacity, sizeof(*table->event_mask));
+    table->x = calloc(capacity, sizeof(*table->x));
+    table->y = calloc(capacity, sizeof(*table->y));
+    table->last_x = calloc(capacity, sizeof(*table->last_x));
+    table->last_y = calloc(capacity, sizeof(*table->last_y));
+    table->major = calloc(capacity, sizeof(*table->major));
+    table->minor = calloc(capacity, sizeof(*table->minor));
+    table->orientation = calloc(capacity, sizeof(*table->orientation));
+    table->buckets = calloc(table->nbuckets, sizeof(*table->buckets));
+    if (table->id == NULL || table->event_mask == NULL || table->x == NULL
+            || table->y == NULL || table->last_x == NULL
+            || table->last_y == NULL || table->major == NULL
+            || table->minor == NULL || table->orientation == NULL
+            || table->buckets == NULL) {
+        touch_table_finish(table);
+        return -1;
+    }
+    clear_buckets(table);
+    return 0;
+}
+
+void
+touch_table_finish(struct touch_table *table)
+{
+    free(table->id);
+    free(table->event_mask);
+    free(table->x);
+    free(table->y);
+    free(table->last_x);
+    free(table->last_y);
+    free(table->major);
+    free(table->minor);
+    free(table->orientation);
+    free(table->buckets);
+    memset(table, 0, sizeof(*table));
+}
+
+int
+touch_table_find(const struct touch_table *table, int32_t id)
+{
+    if (table->buckets == NULL) {
+        return -1;
+    }
+    return table->buckets[probe(table, id)].index;
+}
+
+int
+touch_table_down(struct touch_table *table, int32_t id)
+{
+    if (table->buckets == NULL) {
+        return -1;
+    }
+    struct touch_bucket *bucket = &table->buckets[probe(table, id)];
+    if (bucket->index >= 0) {
+        return bucket->index;
+    }
+    if (table->count == table->capacity) {
+        ++table->dropped;
+        return -1;
+    }
+
+    uint32_t index = table->count++;
+    if (table->count > table->peak) {
+        table->peak = table->count;
+    }
+    bucket->id = id;
+    bucket->index = index;
+    table->id[index] = id;
+    table->event_mask[index] = 0;
+    table->x[index] = table->y[index] = 0;
+    table->last_x[index] = table->last_y[index] = 0;
+    table->major[index] = table->minor[index] = 0;
+    table->orientation[index] = 0;
+    return index;
+}
+
+/* Fills the hole at index with the last contact */
+static void
+remove_contact(struct touch_table *table, uint32_t index)
+{
+    remove_bucket(table, probe(table, table->id[index]));
+    uint32_t last = --table->count;
+    if (index == last) {
+        return;
+    }
+    table->buckets[probe(table, table->id[last])].index = index;
+    table->id[index] = table->id[last];
+    table->event_mask[index] = table->event_mask[last];
+    table->x[index] = table->x[last];
+    table->y[index] = table->y[last];
+    table->last_x[index] = table->last_x[last];
+    table->last_y[index] = table->last_y[last];
+    table->major[index] = table->major[last];
+    table->minor[index] = table->minor[last];
+    table->orientation[index] = table->orientation[last];
+}
+
+void
+touch_table_end_frame(struct touch_table *table)
+{
+    for (uint32_t i = 0; i < table->count; ) {
+        if (table->event_mask[i] & TOUCH_EVENT_UP) {
+            /* The last contact moved here, look at it next */
+            remove_contact(table, i);
+            continue;
+        }
+        table->event_mask[i] = 0;
+        table->last_x[i] = table->x[i];
+        table->last_y[i] = table->y[i];
+        ++i;
+    }
+}
+
+void
+touch_table_clear(struct touch_table *table)
+{
+    if (table->buckets == NULL) {
+        return;
+    }
+    table->count = 0;
+    clear_buckets(table);
+}
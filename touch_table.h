@@ -0,0 +1,71 @@
+#ifndef TOUCH_TABLE_H
+#define TOUCH_TABLE_H
+
+#include <stdint.h>
+#include <wayland-client.h>
+
+/* Contacts tracked unless WL_TOUCH_CAPACITY says otherwise */
+#define TOUCH_TABLE_DEFAULT_CAPACITY 64
+
+enum touch_event_mask {
+    TOUCH_EVENT_DOWN = 1 << 0,
+    TOUCH_EVENT_UP = 1 << 1,
+    TOUCH_EVENT_MOTION = 1 << 2,
+    /* For the whole frame, never set on a contact */
+    TOUCH_EVENT_CANCEL = 1 << 3,
+    TOUCH_EVENT_SHAPE = 1 << 4,
+    TOUCH_EVENT_ORIENTATION = 1 << 5,
+};
+
+/*
+ * The contacts currently down, by wl_touch id. Contacts are packed at
+ * indices 0 to count - 1, one array per field, so a frame walks just the
+ * live contacts and only the fields it needs. An open addressed hash maps
+ * ids to indices; lifting a contact moves the last one into its place.
+ *
+ * Indices hold from one touch_table_end_frame() to the next.
+ */
+struct touch_table {
+    uint32_t capacity;
+    uint32_t count;
+
+    int32_t *id;
+    uint32_t *event_mask;
+    wl_fixed_t *x, *y;
+    /* Where the contact was at the end of the last frame */
+    wl_fixed_t *last_x, *last_y;
+    wl_fixed_t *major, *minor;
+    wl_fixed_t *orientation;
+
+    /* Power of two, at least twice the capacity to keep probes short */
+    uint32_t nbuckets;
+    struct touch_bucket {
+        int32_t id;
+        /* -1 if empty */
+        int32_t index;
+    } *buckets;
+
+    /* Went down while every slot was taken, their events are ignored */
+    uint64_t dropped;
+    uint32_t peak;
+};
+
+int touch_table_init(struct touch_table *table, uint32_t capacity);
+void touch_table_finish(struct touch_table *table);
+
+/* The index of contact id, -1 if it isn't down */
+int touch_table_find(const struct touch_table *table, int32_t id);
+
+/* Adds contact id, or finds it if it's down already; -1 if full */
+int touch_table_down(struct touch_table *table, int32_t id);
+
+/*
+ * After wl_touch.frame: removes the contacts that went up, clears the
+ * event masks of the rest and remembers their positions.
+ */
+void touch_table_end_frame(struct touch_table *table);
+
+/* Removes every contact, e.g. on wl_touch.cancel */
+void touch_table_clear(struct touch_table *table);
+
+#endif
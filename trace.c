@@ -0,0 +1,449 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+_Static_assert((TRACE_RING_RECORDS & (TRACE_RING_RECORDS - 1)) == 0,
+        "ring size must be a power of two");
+
+struct trace_ring {
+    struct trace_ring *next;
+    pid_t tid;
+    char name[16];
+    /* Records ever written, the newest TRACE_RING_RECORDS of them kept */
+    _Atomic uint64_t head;
+    struct trace_record records[TRACE_RING_RECORDS];
+};
+
+atomic_bool trace_recording;
+
+/* Every thread's ring, only added to until trace_finish() */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_ring *rings;
+
+/* Only the owning thread writes its ring, exporting only reads it */
+static _Thread_local struct trace_ring *ring;
+static _Thread_local bool ring_failed;
+
+void
+trace_start(void)
+{
+    atomic_store_explicit(&trace_recording, true, memory_order_relaxed);
+}
+
+void
+trace_stop(void)
+{
+    atomic_store_explicit(&trace_recording, false, memory_order_relaxed);
+}
+
+void
+trace_finish(void)
+{
+    trace_stop();
+    pthread_mutex_lock(&rings_lock);
+    while (rings != NULL) {
+        struct trace_ring *next = rings->next;
+        free(rings);
+        rings = next;
+    }
+    pthread_mutex_unlock(&rings_lock);
+    ring = NULL;
+    ring_failed = false;
+}
+
+uint64_t
+trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct trace_ring *
+open_ring(void)
+{
+    struct trace_ring *new_ring = calloc(1, sizeof(*new_ring));
+    if (new_ring == NULL) {
+        return NULL;
+    }
+    new_ring->tid = gettid();
+    prctl(PR_GET_NAME, new_ring->name);
+
+    pthread_mutex_lock(&rings_lock);
+    new_ring->next = rings;
+    rings = new_ring;
+    pthread_mutex_unlock(&rings_lock);
+    return new_ring;
+}
+
+void
+trace_complete(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+    if (ring == NULL) {
+        if (ring_failed) {
+            return;
+        }
+        ring = open_ring();
+        if (ring == NULL) {
+            ring_failed = true;
+            return;
+        }
+    }
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    struct trace_record *record =
+        &ring->records[head & (TRACE_RING_RECORDS - 1)];
+    record->start_ns = start_ns;
+    record->duration_ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    record->name = name;
+    /* An exporter that sees head also sees the record behind it */
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+static int
+compare_records(const void *a, const void *b)
+{
+    const struct trace_record *ra = a, *rb = b;
+    if (ra->start_ns != rb->start_ns) {
+        return ra->start_ns < rb->start_ns ? -1 : 1;
+    }
+    /* The enclosing slice first */
+    if (ra->duration_ns != rb->duration_ns) {
+        return ra->duration_ns > rb->duration_ns ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Copies what the ring holds into out, sorted by start, and returns how
+ * many. A record the owner overwrote while we copied it is dropped.
+ */
+static size_t
+snapshot_ring(struct trace_ring *src, struct trace_record *out)
+{
+    uint64_t head = atomic_load_explicit(&src->head, memory_order_acquire);
+    uint64_t first = head > TRACE_RING_RECORDS
+        ? head - TRACE_RING_RECORDS : 0;
+    size_t count = 0;
+    for (uint64_t i = first; i < head; ++i) {
+        out[count] = src->records[i & (TRACE_RING_RECORDS - 1)];
+        atomic_thread_fence(memory_order_acquire);
+        /* The owner starts on record i + capacity once head reaches it */
+        uint64_t now = atomic_load_explicit(&src->head, memory_order_relaxed);
+        if (now - i < TRACE_RING_RECORDS) {
+            ++count;
+        }
+    }
+    qsort(out, count, sizeof(*out), compare_records);
+    return count;
+}
+
+static void
+write_json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s != '\0'; ++s) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(out, "\\u%04x", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/* Trace-event timestamps are in us, keep the ns as a fraction */
+static void
+write_json_us(FILE *out, const char *key, uint64_t ns)
+{
+    fprintf(out, "\"%s\":%llu.%03u", key,
+            (unsigned long long)(ns / 1000), (unsigned)(ns % 1000));
+}
+
+static void
+write_json_ring(FILE *out, pid_t pid, const struct trace_ring *src,
+        const struct trace_record *records, size_t count, bool *first)
+{
+    fprintf(out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\","
+            "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+            *first ? "" : ",", (int)pid, (int)src->tid);
+    write_json_string(out, src->name);
+    fputs("}}", out);
+    *first = false;
+
+    for (size_t i = 0; i < count; ++i) {
+        fputs(",\n{\"name\":", out);
+        write_json_string(out, records[i].name);
+        fprintf(out, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,",
+                (int)pid, (int)src->tid);
+        write_json_us(out, "ts", records[i].start_ns);
+        fputc(',', out);
+        write_json_us(out, "dur", records[i].duration_ns);
+        fputc('}', out);
+    }
+}
+
+/*
+ * Just enough of the protobuf wire format for the handful of Perfetto
+ * messages we write, each built in a fixed buffer and nested as bytes.
+ */
+#define PB_MAX 512
+#define PB_VARINT 0
+#define PB_BYTES 2
+
+/* Field numbers from perfetto/trace/trace_packet.proto and friends */
+#define TRACE_PACKET 1
+#define PACKET_CLOCK_SNAPSHOT 6
+#define PACKET_TIMESTAMP 8
+#define PACKET_SEQUENCE_ID 10
+#define PACKET_TRACK_EVENT 11
+#define PACKET_SEQUENCE_FLAGS 13
+#define PACKET_TIMESTAMP_CLOCK_ID 58
+#define PACKET_TRACK_DESCRIPTOR 60
+#define CLOCK_SNAPSHOT_CLOCKS 1
+#define CLOCK_ID 1
+#define CLOCK_TIMESTAMP 2
+#define TRACK_DESCRIPTOR_UUID 1
+#define TRACK_DESCRIPTOR_THREAD 4
+#define THREAD_PID 1
+#define THREAD_TID 2
+#define THREAD_NAME 5
+#define TRACK_EVENT_TYPE 9
+#define TRACK_EVENT_TRACK_UUID 11
+#define TRACK_EVENT_NAME 23
+
+#define SLICE_BEGIN 1
+#define SLICE_END 2
+#define BUILTIN_CLOCK_MONOTONIC 3
+#define BUILTIN_CLOCK_BOOTTIME 6
+#define SEQ_INCREMENTAL_STATE_CLEARED 1
+#define SEQUENCE_ID 1
+
+struct pb {
+    size_t len;
+    uint8_t data[PB_MAX];
+};
+
+static void
+pb_varint(struct pb *pb, uint64_t value)
+{
+    do {
+        if (pb->len == PB_MAX) {
+            return;
+        }
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        pb->data[pb->len++] = value != 0 ? byte | 0x80 : byte;
+    } while (value != 0);
+}
+
+static void
+pb_uint(struct pb *pb, unsigned field, uint64_t value)
+{
+    pb_varint(pb, field << 3 | PB_VARINT);
+    pb_varint(pb, value);
+}
+
+/* Names past this are cut short, so every message fits in PB_MAX */
+#define PB_MAX_STRING 128
+
+static void
+pb_bytes(struct pb *pb, unsigned field, const void *data, size_t len)
+{
+    pb_varint(pb, field << 3 | PB_BYTES);
+    pb_varint(pb, len);
+    if (len > PB_MAX - pb->len) {
+        len = PB_MAX - pb->len;
+    }
+    memcpy(pb->data + pb->len, data, len);
+    pb->len += len;
+}
+
+static void
+pb_string(struct pb *pb, unsigned field, const char *s)
+{
+    size_t len = strlen(s);
+    pb_bytes(pb, field, s, len < PB_MAX_STRING ? len : PB_MAX_STRING);
+}
+
+static void
+pb_message(struct pb *pb, unsigned field, const struct pb *message)
+{
+    pb_bytes(pb, field, message->data, message->len);
+}
+
+/* Each packet is a field of the top-level Trace message */
+static void
+write_packet(FILE *out, struct pb *packet)
+{
+    pb_uint(packet, PACKET_SEQUENCE_ID, SEQUENCE_ID);
+    struct pb frame = { 0 };
+    pb_varint(&frame, TRACE_PACKET << 3 | PB_BYTES);
+    pb_varint(&frame, packet->len);
+    fwrite(frame.data, 1, frame.len, out);
+    fwrite(packet->data, 1, packet->len, out);
+}
+
+/* Lets trace processor line our monotonic timestamps up with its own */
+static void
+write_perfetto_clocks(FILE *out)
+{
+    struct timespec mono, boot;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+
+    struct pb clocks[2] = { 0 };
+    pb_uint(&clocks[0], CLOCK_ID, BUILTIN_CLOCK_MONOTONIC);
+    pb_uint(&clocks[0], CLOCK_TIMESTAMP,
+            mono.tv_sec * 1000000000ULL + mono.tv_nsec);
+    pb_uint(&clocks[1], CLOCK_ID, BUILTIN_CLOCK_BOOTTIME);
+    pb_uint(&clocks[1], CLOCK_TIMESTAMP,
+            boot.tv_sec * 1000000000ULL + boot.tv_nsec);
+    struct pb snapshot = { 0 };
+    pb_message(&snapshot, CLOCK_SNAPSHOT_CLOCKS, &clocks[0]);
+    pb_message(&snapshot, CLOCK_SNAPSHOT_CLOCKS, &clocks[1]);
+
+    struct pb packet = { 0 };
+    pb_message(&packet, PACKET_CLOCK_SNAPSHOT, &snapshot);
+    pb_uint(&packet, PACKET_SEQUENCE_FLAGS, SEQ_INCREMENTAL_STATE_CLEARED);
+    write_packet(out, &packet);
+}
+
+static void
+write_perfetto_slice(FILE *out, uint64_t track, uint64_t ns, int type,
+        const char *name)
+{
+    struct pb event = { 0 };
+    pb_uint(&event, TRACK_EVENT_TYPE, type);
+    pb_uint(&event, TRACK_EVENT_TRACK_UUID, track);
+    if (name != NULL) {
+        pb_string(&event, TRACK_EVENT_NAME, name);
+    }
+
+    struct pb packet = { 0 };
+    pb_uint(&packet, PACKET_TIMESTAMP, ns);
+    pb_uint(&packet, PACKET_TIMESTAMP_CLOCK_ID, BUILTIN_CLOCK_MONOTONIC);
+    pb_message(&packet, PACKET_TRACK_EVENT, &event);
+    write_packet(out, &packet);
+}
+
+/*
+ * Perfetto wants begin and end events in order on each track. Records are
+ * sorted by start with enclosing slices first, so a stack of open slices
+ * tells us when each one ends.
+ */
+static void
+write_perfetto_ring(FILE *out, pid_t pid, const struct trace_ring *src,
+        const struct trace_record *records, size_t count)
+{
+    uint64_t track = (uint64_t)pid << 32 | (uint32_t)src->tid;
+
+    struct pb thread = { 0 };
+    pb_uint(&thread, THREAD_PID, pid);
+    pb_uint(&thread, THREAD_TID, src->tid);
+    pb_string(&thread, THREAD_NAME, src->name);
+    struct pb descriptor = { 0 };
+    pb_uint(&descriptor, TRACK_DESCRIPTOR_UUID, track);
+    pb_message(&descriptor, TRACK_DESCRIPTOR_THREAD, &thread);
+    struct pb packet = { 0 };
+    pb_message(&packet, PACKET_TRACK_DESCRIPTOR, &descriptor);
+    write_packet(out, &packet);
+
+    uint64_t open[64];
+    int depth = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const struct trace_record *record = &records[i];
+        while (depth > 0 && open[depth - 1] <= record->start_ns) {
+            write_perfetto_slice(out, track, open[--depth], SLICE_END, NULL);
+        }
+        if (depth == sizeof(open) / sizeof(open[0])) {
+            continue;
+        }
+        uint64_t end = record->start_ns + record->duration_ns;
+        /* Overlapping without nesting can't be shown, clip it */
+        if (depth > 0 && end > open[depth - 1]) {
+            end = open[depth - 1];
+        }
+        write_perfetto_slice(out, track, record->start_ns, SLICE_BEGIN,
+                record->name);
+        open[depth++] = end;
+    }
+    while (depth > 0) {
+        write_perfetto_slice(out, track, open[--depth], SLICE_END, NULL);
+    }
+}
+
+int
+trace_export(const char *path, enum trace_format format)
+{
+    struct trace_record *records = malloc(
+            TRACE_RING_RECORDS * sizeof(*records));
+    if (records == NULL) {
+        return -1;
+    }
+    FILE *out = fopen(path, "we");
+    if (out == NULL) {
+        int saved = errno;
+        free(records);
+        errno = saved;
+        return -1;
+    }
+
+    pid_t pid = getpid();
+    bool first = true;
+    if (format == TRACE_FORMAT_JSON) {
+        fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", out);
+    } else {
+        write_perfetto_clocks(out);
+    }
+    /* Rings are never removed while we run, only pushed in front */
+    pthread_mutex_lock(&rings_lock);
+    struct trace_ring *head = rings;
+    pthread_mutex_unlock(&rings_lock);
+    for (struct trace_ring *src = head; src != NULL; src = src->next) {
+        size_t count = snapshot_ring(src, records);
+        if (format == TRACE_FORMAT_JSON) {
+            write_json_ring(out, pid, src, records, count, &first);
+        } else {
+            write_perfetto_ring(out, pid, src, records, count);
+        }
+    }
+    if (format == TRACE_FORMAT_JSON) {
+        fputs("\n]}\n", out);
+    }
+    free(records);
+
+    if (ferror(out)) {
+        fclose(out);
+        errno = EIO;
+        return -1;
+    }
+    return fclose(out);
+}
+
+static bool
+has_suffix(const char *s, const char *suffix)
+{
+    size_t len = strlen(s), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcmp(s + len - suffix_len, suffix) == 0;
+}
+
+enum trace_format
+trace_format_for_path(const char *path)
+{
+    if (has_suffix(path, ".pftrace") || has_suffix(path, ".perfetto-trace")) {
+        return TRACE_FORMAT_PERFETTO;
+    }
+    return TRACE_FORMAT_JSON;
+}
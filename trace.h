@@ -0,0 +1,108 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Scoped trace events for seeing what the event loop and the render
+ * threads were doing. Each thread appends to its own in-memory ring, so
+ * recording takes no lock; trace_export() writes every ring out as
+ * Chrome trace-event JSON (chrome://tracing, ui.perfetto.dev) or as a
+ * Perfetto protobuf trace.
+ *
+ * Recording is off until trace_start(). Build with -DTRACE_ENABLED=0 to
+ * compile every trace point out.
+ */
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+/* Events kept per thread, a power of two: 384 KiB each */
+#define TRACE_RING_RECORDS (1 << 14)
+
+enum trace_format {
+    TRACE_FORMAT_JSON,
+    TRACE_FORMAT_PERFETTO,
+};
+
+/* One complete slice; name must outlive the trace, e.g. a literal */
+struct trace_record {
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    const char *name;
+};
+
+/* Live for a TRACE_SCOPE, start_ns is 0 when recording was off */
+struct trace_scope {
+    const char *name;
+    uint64_t start_ns;
+};
+
+extern atomic_bool trace_recording;
+
+static inline bool
+trace_on(void)
+{
+    return atomic_load_explicit(&trace_recording, memory_order_relaxed);
+}
+
+void trace_start(void);
+void trace_stop(void);
+/* Frees the rings of every thread; call once the others have exited */
+void trace_finish(void);
+
+/* CLOCK_MONOTONIC ns, the same clock as frame_stats_now() */
+uint64_t trace_now(void);
+void trace_complete(const char *name, uint64_t start_ns, uint64_t end_ns);
+
+static inline struct trace_scope
+trace_scope_begin(const char *name)
+{
+    struct trace_scope scope = { name, trace_on() ? trace_now() : 0 };
+    return scope;
+}
+
+static inline void
+trace_scope_end(struct trace_scope *scope)
+{
+    if (scope->start_ns != 0) {
+        trace_complete(scope->name, scope->start_ns, trace_now());
+    }
+}
+
+/*
+ * Writes what the rings hold now, oldest first; other threads may go on
+ * recording meanwhile. Returns -1 with errno set if path can't be written.
+ */
+int trace_export(const char *path, enum trace_format format);
+/* Perfetto for *.pftrace and *.perfetto-trace, JSON for anything else */
+enum trace_format trace_format_for_path(const char *path);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#if TRACE_ENABLED
+/* A slice from here to the end of the enclosing block */
+#define TRACE_SCOPE(name) \
+    __attribute__((cleanup(trace_scope_end))) struct trace_scope \
+            TRACE_CONCAT(trace_scope_, __LINE__) = trace_scope_begin(name)
+/* A slice for the timestamps the caller already took */
+#define TRACE_COMPLETE(name, start_ns, end_ns) do { \
+    if (trace_on()) { \
+        trace_complete((name), (start_ns), (end_ns)); \
+    } \
+} while (0)
+#else
+#define TRACE_SCOPE(name) do { } while (0)
+/* Still counts as using the timestamps, without evaluating them */
+#define TRACE_COMPLETE(name, start_ns, end_ns) \
+    ((void)sizeof((start_ns) + (end_ns)))
+#endif
+
+/* A slice named after the enclosing function */
+#define TRACE_FUNC() TRACE_SCOPE(__func__)
+
+#endif
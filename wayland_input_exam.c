@@ -1,16 +1,46 @@
-#define _POSIX_C_SOURCE 200112L
+#define _POSIX_C_SOURCE 200809L
 
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <math.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-client.h>
 #include "xdg-shell-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "blit.h"
+#include "buffer_pool.h"
+#include "damage.h"
+#include "evlog.h"
+#include "event_loop.h"
+#include "frame_pacing.h"
+#include "frame_stats.h"
+#include "gesture.h"
+#include "input_latency.h"
+#include "input_trace.h"
+#include "key_repeat.h"
+#include "keymap_cache.h"
+#include "keysym_cache.h"
+#include "metrics.h"
+#include "motion_history.h"
+#include "phase_cache.h"
+#include "pointer_predict.h"
+#include "touch_table.h"
+#include "render.h"
+#include "render_thread.h"
+#include "thread_pool.h"
+#include "trace.h"
+#include "shm.h"
 
 #include <assert.h>
 #include <xkbcommon/xkbcommon.h>
@@ -18,53 +48,6 @@
 #include <linux/input.h> // for BTN_LEFT
 
 
-/* Shared memory support code */
-static void
-randname(char *buf)
-{
-    struct timespec ts;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    long r = ts.tv_nsec;
-    for (int i = 0; i < 6; ++i) {
-        buf[i] = 'A'+(r&15)+(r&16)*2;
-        r >>= 5;
-    }
-}
-
-static int
-create_shm_file(void)
-{
-    int retries = 100;
-    do {
-        char name[] = "/wl_shm-XXXXXX";
-        randname(name + sizeof(name) - 7);
-        --retries;
-        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
-        if (fd >= 0) {
-            shm_unlink(name);
-            return fd;
-        }
-    } while (retries > 0 && errno == EEXIST);
-    return -1;
-}
-
-static int
-allocate_shm_file(size_t size)
-{
-    int fd = create_shm_file();
-    if (fd < 0)
-        return -1;
-    int ret;
-    do {
-        ret = ftruncate(fd, size);
-    } while (ret < 0 && errno == EINTR);
-    if (ret < 0) {
-        close(fd);
-        return -1;
-    }
-    return fd;
-}
-
 enum pointer_event_mask {
        POINTER_EVENT_ENTER = 1 << 0,
        POINTER_EVENT_LEAVE = 1 << 1,
@@ -76,9 +59,9 @@ enum pointer_event_mask {
        POINTER_EVENT_AXIS_DISCRETE = 1 << 7,
 };
 
+/* Accumulated until wl_pointer.frame, positions go to motion_history */
 struct pointer_event {
        uint32_t event_mask;
-       wl_fixed_t surface_x, surface_y;
        uint32_t button, state;
        uint32_t time;
        uint32_t serial;
@@ -90,32 +73,41 @@ struct pointer_event {
        uint32_t axis_source;
 };
 
-enum touch_event_mask {
-       TOUCH_EVENT_DOWN = 1 << 0,
-       TOUCH_EVENT_UP = 1 << 1,
-       TOUCH_EVENT_MOTION = 1 << 2,
-       TOUCH_EVENT_CANCEL = 1 << 3,
-       TOUCH_EVENT_SHAPE = 1 << 4,
-       TOUCH_EVENT_ORIENTATION = 1 << 5,
-};
-
-struct touch_point {
-       bool valid;
-       int32_t id;
-       uint32_t event_mask;
-       wl_fixed_t surface_x, surface_y;
-       wl_fixed_t major, minor;
-       wl_fixed_t orientation;
-};
-
 struct touch_event {
        uint32_t event_mask;
        uint32_t time;
        uint32_t serial;
-       struct touch_point points[10];
+       struct touch_table points;
 };
 
 
+/*
+ * One frame, planned on the Wayland thread and painted either right away or
+ * ahead of time on the render thread.
+ */
+struct frame_job {
+    /* What to attach on commit, NULL if the frame is unchanged */
+    struct wl_buffer *wl_buffer;
+    struct damage damage;
+
+    /* A pre-rendered frame, marked busy once attached */
+    struct pool_buffer *cached;
+
+    /* Pixel work, only when buffer is set */
+    struct pool_buffer *buffer;
+    const struct pool_buffer *prev;
+    int width, height, stride;
+    int offset, delta;
+    struct damage repaint;
+    struct thread_pool *render_pool;
+    struct frame_stats *stats;
+    /* The input this frame is the first to reflect */
+    struct input_tag input;
+    /* Where the pointer will be when the frame is shown, for anything
+     * drawn to follow it */
+    struct pointer_prediction pointer;
+};
+
 /* Wayland code */
 struct client_state {
     /* Globals */
@@ -125,6 +117,7 @@ struct client_state {
     struct wl_compositor *wl_compositor;
     struct xdg_wm_base *xdg_wm_base;
     struct wl_seat *wl_seat;
+    struct wp_viewporter *wp_viewporter;
 
     /* Objects */
     struct wl_surface *wl_surface;
@@ -133,70 +126,288 @@ struct client_state {
     struct wl_keyboard *wl_keyboard;
     struct wl_pointer *wl_pointer;
     struct wl_touch *wl_touch;
+    struct wp_viewport *wp_viewport;
 
     /* State */
+    struct event_loop *event_loop;
     float offset;
     uint32_t last_frame;
+    /* ms between the last two frame callbacks */
+    int frame_elapsed;
     int width, height;
     bool closed;
     struct pointer_event pointer_event;
+    struct motion_history motion_history;
+    struct pointer_predict pointer_predict;
     struct xkb_state *xkb_state;
     struct xkb_context *xkb_context;
     struct xkb_keymap *xkb_keymap;
+    struct keymap_cache keymap_cache;
+    struct keysym_cache keysym_cache;
+    struct key_repeat key_repeat;
     struct touch_event touch_event;
+    struct gesture gesture;
+    /* gesture_frame() per touch frame, in ns */
+    struct frame_histogram gesture_cost;
+    /* Set while recording input, see WL_INPUT_RECORD */
+    struct input_trace *input_trace;
+    struct buffer_pool buffer_pool;
+    struct phase_cache phase_cache;
+    struct buffer_pool viewport_pool;
+    struct damage_history damage_history;
+    struct thread_pool *render_pool;
+    struct render_thread *render_thread;
+    struct frame_job frame_job;
+    int drawn_offset, drawn_width, drawn_height;
+    /* Unwrapped scroll position and pool buffer of the last frame drawn */
+    int drawn_scroll;
+    struct pool_buffer *drawn_buffer;
+    struct frame_stats frame_stats;
+    struct input_latency input_latency;
+    /* SIGUSR1 prints frame_stats, SIGUSR2 exports the trace */
+    int stats_signal_fd;
+    struct event_source *stats_signal;
+    struct frame_pacing frame_pacing;
+    /* Starts a frame the pacing held back, see WL_PACING_MARGIN_US */
+    struct event_source *pacing_timer;
+    /* Published for metrics_read, see WL_METRICS */
+    struct metrics metrics;
+    /* Where SIGUSR2 and exiting write the trace, see WL_TRACE */
+    const char *trace_path;
+};
+
+struct fill_job {
+    uint32_t *data;
+    int stride, offset;
+    struct damage_rect rect;
+    int band_rows;
 };
 
 static void
-wl_buffer_release(void *data, struct wl_buffer *wl_buffer)
+fill_band(void *data, int index)
 {
-    /* Sent by the compositor when it's no longer using this buffer */
-    wl_buffer_destroy(wl_buffer);
+    TRACE_FUNC();
+    struct fill_job *job = data;
+    int y = job->rect.y + index * job->band_rows;
+    int rows = job->rect.y + job->rect.height - y;
+    if (rows > job->band_rows) {
+        rows = job->band_rows;
+    }
+    render_checkerboard_region(job->data, job->stride, job->offset,
+            job->rect.x, y, job->rect.width, rows);
 }
 
-static const struct wl_buffer_listener wl_buffer_listener = {
-    .release = wl_buffer_release,
-};
+/* Split the rectangle into L2-sized row bands and fill them in parallel */
+static void
+fill_rect(struct thread_pool *render_pool, uint32_t *data, int stride,
+        int offset, const struct damage_rect *rect)
+{
+    struct fill_job job = {
+        .data = data,
+        .stride = stride,
+        .offset = offset,
+        .rect = *rect,
+        .band_rows = thread_pool_band_rows(render_pool,
+                (size_t)rect->width * 4),
+    };
+    int nbands = (rect->height + job.band_rows - 1) / job.band_rows;
+    thread_pool_run(render_pool, nbands, fill_band, &job);
+}
 
-static struct wl_buffer *
-draw_frame(struct client_state *state)
+/* Touches nothing but the job and its buffers, so any thread may run it */
+static void
+paint_frame(void *data)
+{
+    TRACE_FUNC();
+    struct frame_job *job = data;
+    if (job->buffer == NULL) {
+        return;
+    }
+    uint64_t start = frame_stats_now();
+
+    struct damage repaint = job->repaint;
+    if (job->prev != NULL) {
+        /*
+         * The previous frame is intact: shift it by the scroll delta and
+         * only rasterize the stripe that scrolled into view. The damage we
+         * report stays full, every pixel on screen did move.
+         */
+        blit_scroll(job->buffer->data, job->prev->data,
+                job->width, job->height, job->stride,
+                job->delta, job->delta, &repaint);
+    }
+
+    /* Draw checkerboxed background */
+    for (int i = 0; i < repaint.nrects; ++i) {
+        fill_rect(job->render_pool, job->buffer->data, job->stride,
+                job->offset, &repaint.rects[i]);
+    }
+    frame_stats_lap(job->stats, FRAME_STAGE_PAINT, start);
+}
+
+/*
+ * The checkerboard at phase n is the phase 0 pattern shifted by (n, n), so
+ * with wp_viewporter we render one buffer 8 pixels larger than the surface
+ * once and scroll by moving the source rectangle. Returns false if the
+ * buffer could not be allocated.
+ */
+static bool
+plan_frame_viewport(struct client_state *state, struct frame_job *job)
 {
     int width = state->width, height = state->height;
-    int stride = width * 4;
-    int size = stride * height;
+    struct buffer_pool *pool = &state->viewport_pool;
 
-    int fd = allocate_shm_file(size);
-    if (fd == -1) {
-        return NULL;
+    if (pool->width != width + 8 || pool->height != height + 8) {
+        struct pool_buffer *slot = buffer_pool_acquire(pool,
+                width + 8, height + 8);
+        if (slot == NULL) {
+            return false;
+        }
+        render_checkerboard(slot->data, pool->width, pool->height,
+                pool->stride, 0);
+        damage_add(&job->damage, 0, 0, pool->width, pool->height);
+        job->wl_buffer = slot->wl_buffer;
     }
 
-    uint32_t *data = mmap(NULL, size,
-            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED) {
-        close(fd);
-        return NULL;
+    wp_viewport_set_source(state->wp_viewport,
+            wl_fixed_from_int(job->offset), wl_fixed_from_int(job->offset),
+            wl_fixed_from_int(width), wl_fixed_from_int(height));
+    wp_viewport_set_destination(state->wp_viewport, width, height);
+    return true;
+}
+
+/*
+ * When a frame committed frames_ahead frame callbacks from now will be
+ * shown, in CLOCK_MONOTONIC: the refresh wp_presentation predicts, else
+ * a frame deadline from now.
+ */
+static uint64_t
+predict_present(const struct client_state *state, int frames_ahead)
+{
+    uint64_t period = state->frame_pacing.refresh_ns;
+    if (period == 0) {
+        period = state->frame_stats.deadline_ns;
     }
+    uint64_t next = frame_pacing_next_present(&state->frame_pacing);
+    if (next == 0) {
+        next = frame_stats_now() + period;
+    }
+    return next + frames_ahead * period;
+}
 
-    struct wl_shm_pool *pool = wl_shm_create_pool(state->wl_shm, fd, size);
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0,
-            width, height, stride, WL_SHM_FORMAT_XRGB8888);
-    wl_shm_pool_destroy(pool);
-    close(fd);
+/*
+ * Decides what the frame at scroll position `position`, to be shown at
+ * present_ns, needs: which buffer to attach, its damage, and the pixel
+ * work left for paint_frame().
+ */
+static void
+plan_frame(struct client_state *state, float position, uint64_t present_ns,
+        struct frame_job *job)
+{
+    TRACE_FUNC();
+    int width = state->width, height = state->height;
+    int scroll = (int)position;
+    int offset = scroll % 8;
+
+    memset(job, 0, sizeof(*job));
+    job->width = width;
+    job->height = height;
+    job->offset = offset;
+    job->render_pool = state->render_pool;
+    job->stats = &state->frame_stats;
+    input_latency_take(&state->input_latency, &job->input);
+    motion_history_take(&state->motion_history, NULL);
+    pointer_predict(&state->pointer_predict, &state->motion_history,
+            present_ns, &job->pointer);
+
+    /* Scrolling changes every pixel, otherwise nothing changed at all */
+    if (offset == state->drawn_offset
+            && width == state->drawn_width && height == state->drawn_height) {
+        return;
+    }
 
+    if (state->wp_viewport != NULL) {
+        if (!plan_frame_viewport(state, job)) {
+            return;
+        }
+        state->drawn_offset = offset;
+        state->drawn_width = width;
+        state->drawn_height = height;
+        state->drawn_scroll = scroll;
+        state->drawn_buffer = NULL;
+        return;
+    }
 
-    /* Draw checkerboxed background */
-        int offset = (int)state->offset % 8;
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            if (((x + offset) + (y + offset) / 8 * 8) % 16 < 8)
-                data[y * width + x] = 0xFF666666;
-            else
-                data[y * width + x] = 0xFFEEEEEE;
+    /* Steady state: every phase is already rendered, just reattach it */
+    struct pool_buffer *cached = phase_cache_get(&state->phase_cache,
+            width, height, offset);
+    struct pool_buffer *buffer = NULL;
+    if (cached == NULL) {
+        buffer = buffer_pool_acquire(&state->buffer_pool, width, height);
+        if (buffer == NULL) {
+            return;
         }
     }
 
-    munmap(data, size);
-    wl_buffer_add_listener(buffer, &wl_buffer_listener, NULL);
-    return buffer;
+    damage_add(&job->damage, 0, 0, width, height);
+    uint64_t frame = damage_history_push(&state->damage_history,
+            &job->damage);
+    struct pool_buffer *prev = state->drawn_buffer;
+    job->delta = scroll - state->drawn_scroll;
+    state->drawn_offset = offset;
+    state->drawn_width = width;
+    state->drawn_height = height;
+    state->drawn_scroll = scroll;
+    state->drawn_buffer = buffer;
+    if (cached != NULL) {
+        job->wl_buffer = cached->wl_buffer;
+        job->cached = cached;
+        return;
+    }
+
+    job->wl_buffer = buffer->wl_buffer;
+    job->buffer = buffer;
+    job->stride = state->buffer_pool.stride;
+    if (prev != NULL && prev->frame == frame - 1) {
+        job->prev = prev;
+    } else if (!damage_history_since(&state->damage_history,
+                buffer->frame, &job->repaint)) {
+        /* Only repaint what changed since this buffer was last drawn */
+        damage_add(&job->repaint, 0, 0, width, height);
+    }
+    buffer->frame = frame;
+}
+
+/*
+ * Throws away a frame painted ahead that will not be shown, e.g. because a
+ * configure needs a frame right now. Its buffer was never attached.
+ */
+static void
+discard_pending_frame(struct client_state *state)
+{
+    struct frame_job *job = render_thread_wait(state->render_thread);
+    if (job == NULL) {
+        return;
+    }
+    if (job->buffer != NULL) {
+        job->buffer->busy = false;
+    }
+    input_latency_restore(&state->input_latency, &job->input);
+    /* What's on screen is older than drawn_*, force the next frame */
+    state->drawn_offset = -1;
+}
+
+static struct frame_job *
+draw_frame(struct client_state *state)
+{
+    TRACE_FUNC();
+    if (state->render_thread != NULL) {
+        discard_pending_frame(state);
+    }
+    struct frame_job *job = &state->frame_job;
+    plan_frame(state, state->offset, predict_present(state, 0), job);
+    paint_frame(job);
+    return job;
 }
 
 static void
@@ -204,11 +415,15 @@ xdg_toplevel_configure(void *data,
 		struct xdg_toplevel *xdg_toplevel, int32_t width, int32_t height,
 		struct wl_array *states)
 {
+	TRACE_FUNC();
 	struct client_state *state = data;
 	if (width == 0 || height == 0) {
 		/* Compositor is deferring to us */
 		return;
 	}
+	if (width != state->width || height != state->height) {
+		phase_cache_invalidate(&state->phase_cache);
+	}
 	state->width = width;
 	state->height = height;
 }
@@ -216,6 +431,7 @@ xdg_toplevel_configure(void *data,
 static void
 xdg_toplevel_close(void *data, struct xdg_toplevel *toplevel)
 {
+	TRACE_FUNC();
 	struct client_state *state = data;
 	state->closed = true;
 }
@@ -230,15 +446,24 @@ static void
 xdg_surface_configure(void *data,
         struct xdg_surface *xdg_surface, uint32_t serial)
 {
+    TRACE_FUNC();
     static uint32_t x = -100;
     static uint32_t y = 0;
 
     struct client_state *state = data;
     xdg_surface_ack_configure(xdg_surface, serial);
 
-    struct wl_buffer *buffer = draw_frame(state);
-    wl_surface_attach(state->wl_surface, buffer, x, y);
+    struct frame_job *job = draw_frame(state);
+    if (job->wl_buffer != NULL) {
+        wl_surface_attach(state->wl_surface, job->wl_buffer, x, y);
+        if (job->cached != NULL) {
+            job->cached->busy = true;
+        }
+        damage_emit(&job->damage, state->wl_surface);
+    }
     wl_surface_commit(state->wl_surface);
+    input_latency_commit(&state->input_latency, &job->input,
+            frame_stats_now());
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -248,6 +473,7 @@ static const struct xdg_surface_listener xdg_surface_listener = {
 static void
 xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial)
 {
+    TRACE_FUNC();
     xdg_wm_base_pong(xdg_wm_base, serial);
 }
 
@@ -255,26 +481,17 @@ static const struct xdg_wm_base_listener xdg_wm_base_listener = {
     .ping = xdg_wm_base_ping,
 };
 
-static struct touch_point *
-get_touch_point(struct client_state *client_state, int32_t id)
+static void
+handle_gesture(void *data, const struct gesture_event *event)
 {
-       struct touch_event *touch = &client_state->touch_event;
-       const size_t nmemb = sizeof(touch->points) / sizeof(struct touch_point);
-       int invalid = -1;
-       for (size_t i = 0; i < nmemb; ++i) {
-               if (touch->points[i].id == id) {
-                       return &touch->points[i];
-               }
-               if (invalid == -1 && !touch->points[i].valid) {
-                       invalid = i;
-               }
-       }
-       if (invalid == -1) {
-               return NULL;
-       }
-       touch->points[invalid].valid = true;
-       touch->points[invalid].id = id;
-       return &touch->points[invalid];
+       TRACE_FUNC();
+       double value = event->type == GESTURE_PINCH ? event->scale
+               : event->rotation;
+       evlog(EVLOG_INFO, EVLOG_GESTURE, event->time,
+                       event->type | event->phase << 8 | event->fingers << 16,
+                       wl_fixed_from_double(event->dx),
+                       wl_fixed_from_double(event->dy),
+                       (int32_t)lround(value * 1e6));
 }
 
 static void
@@ -282,16 +499,18 @@ wl_touch_down(void *data, struct wl_touch *wl_touch, uint32_t serial,
                uint32_t time, struct wl_surface *surface, int32_t id,
                wl_fixed_t x, wl_fixed_t y)
 {
-        printf("wl_touch_down\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_TOUCH_DOWN, time, serial, id, x, y);
 
        struct client_state *client_state = data;
-       struct touch_point *point = get_touch_point(client_state, id);
-       if (point == NULL) {
+       input_latency_mark(&client_state->input_latency, INPUT_LATENCY_TOUCH);
+       struct touch_table *points = &client_state->touch_event.points;
+       int i = touch_table_down(points, id);
+       if (i < 0) {
                return;
        }
-       point->event_mask |= TOUCH_EVENT_UP;
-       point->surface_x = wl_fixed_to_double(x),
-               point->surface_y = wl_fixed_to_double(y);
+       points->event_mask[i] |= TOUCH_EVENT_DOWN;
+       points->x[i] = x, points->y[i] = y;
        client_state->touch_event.time = time;
        client_state->touch_event.serial = serial;
 }
@@ -300,29 +519,37 @@ static void
 wl_touch_up(void *data, struct wl_touch *wl_touch, uint32_t serial,
                uint32_t time, int32_t id)
 {
-        printf("wl_touch_up\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_TOUCH_UP, time, serial, id);
 
        struct client_state *client_state = data;
-       struct touch_point *point = get_touch_point(client_state, id);
-       if (point == NULL) {
+       input_latency_mark(&client_state->input_latency, INPUT_LATENCY_TOUCH);
+       struct touch_table *points = &client_state->touch_event.points;
+       int i = touch_table_find(points, id);
+       if (i < 0) {
                return;
        }
-       point->event_mask |= TOUCH_EVENT_UP;
+       points->event_mask[i] |= TOUCH_EVENT_UP;
+       /* What a lift is timed by, a long press must not pass for a tap */
+       client_state->touch_event.time = time;
 }
 
 static void
 wl_touch_motion(void *data, struct wl_touch *wl_touch, uint32_t time,
                int32_t id, wl_fixed_t x, wl_fixed_t y)
 {
-        printf("wl_touch_motion\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_TOUCH_MOTION, time, 0, id, x, y);
 
        struct client_state *client_state = data;
-       struct touch_point *point = get_touch_point(client_state, id);
-       if (point == NULL) {
+       input_latency_mark(&client_state->input_latency, INPUT_LATENCY_TOUCH);
+       struct touch_table *points = &client_state->touch_event.points;
+       int i = touch_table_find(points, id);
+       if (i < 0) {
                return;
        }
-       point->event_mask |= TOUCH_EVENT_MOTION;
-       point->surface_x = x, point->surface_y = y;
+       points->event_mask[i] |= TOUCH_EVENT_MOTION;
+       points->x[i] = x, points->y[i] = y;
        client_state->touch_event.time = time;
 
         //xdg_toplevel_move(client_state->xdg_toplevel, client_state->wl_seat, serial);
@@ -331,90 +558,66 @@ wl_touch_motion(void *data, struct wl_touch *wl_touch, uint32_t time,
 static void
 wl_touch_cancel(void *data, struct wl_touch *wl_touch)
 {
-        printf("wl_touch_cancel\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_TOUCH_CANCEL, 0, 0);
 
        struct client_state *client_state = data;
        client_state->touch_event.event_mask |= TOUCH_EVENT_CANCEL;
+       /* Cancel carries no time, the last event's is the nearest there is */
+       gesture_cancel(&client_state->gesture, client_state->touch_event.time);
+       /* The compositor took the whole gesture, ids may be reused */
+       touch_table_clear(&client_state->touch_event.points);
 }
 
 static void
 wl_touch_shape(void *data, struct wl_touch *wl_touch,
                int32_t id, wl_fixed_t major, wl_fixed_t minor)
 {
-        printf("wl_touch_shape\n");
-
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_TOUCH_SHAPE, 0, 0, id, major, minor);
 
        struct client_state *client_state = data;
-       struct touch_point *point = get_touch_point(client_state, id);
-       if (point == NULL) {
+       struct touch_table *points = &client_state->touch_event.points;
+       int i = touch_table_find(points, id);
+       if (i < 0) {
                return;
        }
-       point->event_mask |= TOUCH_EVENT_SHAPE;
-       point->major = major, point->minor = minor;
+       points->event_mask[i] |= TOUCH_EVENT_SHAPE;
+       points->major[i] = major, points->minor[i] = minor;
 }
 
 static void
 wl_touch_orientation(void *data, struct wl_touch *wl_touch,
                int32_t id, wl_fixed_t orientation)
 {
-        printf("wl_touch_orientation\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_TOUCH_ORIENTATION, 0, 0, id, orientation);
 
        struct client_state *client_state = data;
-       struct touch_point *point = get_touch_point(client_state, id);
-       if (point == NULL) {
+       struct touch_table *points = &client_state->touch_event.points;
+       int i = touch_table_find(points, id);
+       if (i < 0) {
                return;
        }
-       point->event_mask |= TOUCH_EVENT_ORIENTATION;
-       point->orientation = orientation;
+       points->event_mask[i] |= TOUCH_EVENT_ORIENTATION;
+       points->orientation[i] = orientation;
 }
 
 static void
 wl_touch_frame(void *data, struct wl_touch *wl_touch)
 {
-        printf("wl_touch_frame\n");
-        
+       TRACE_FUNC();
        struct client_state *client_state = data;
+       metrics_count(&client_state->metrics, METRICS_TOUCH_FRAMES);
        struct touch_event *touch = &client_state->touch_event;
-       const size_t nmemb = sizeof(touch->points) / sizeof(struct touch_point);
-       fprintf(stderr, "touch event @ %d:\n", touch->time);
-
-       for (size_t i = 0; i < nmemb; ++i) {
-               struct touch_point *point = &touch->points[i];
-               if (!point->valid) {
-                       continue;
-               }
-               fprintf(stderr, "point %d: ", touch->points[i].id);
-
-               if (point->event_mask & TOUCH_EVENT_DOWN) {
-                       fprintf(stderr, "down %f,%f ",
-                                       wl_fixed_to_double(point->surface_x),
-                                       wl_fixed_to_double(point->surface_y));
-               }
-
-               if (point->event_mask & TOUCH_EVENT_UP) {
-                       fprintf(stderr, "up ");
-               }
-
-               if (point->event_mask & TOUCH_EVENT_MOTION) {
-                       fprintf(stderr, "motion %f,%f ",
-                                       wl_fixed_to_double(point->surface_x),
-                                       wl_fixed_to_double(point->surface_y));
-               }
-
-               if (point->event_mask & TOUCH_EVENT_SHAPE) {
-                       fprintf(stderr, "shape %fx%f ",
-                                       wl_fixed_to_double(point->major),
-                                       wl_fixed_to_double(point->minor));
-               }
-
-               if (point->event_mask & TOUCH_EVENT_ORIENTATION) {
-                       fprintf(stderr, "orientation %f ",
-                                       wl_fixed_to_double(point->orientation));
-               }
-
-              point->valid = false;
-               fprintf(stderr, "\n");
-       }
+       evlog(EVLOG_INFO, EVLOG_TOUCH_FRAME, touch->time, 0);
+
+       uint64_t start = frame_stats_now();
+       gesture_frame(&client_state->gesture, &touch->points, touch->time);
+       frame_histogram_record(&client_state->gesture_cost,
+                       frame_stats_now() - start);
+       touch_table_end_frame(&touch->points);
+       touch->event_mask = 0;
 }
 
 static const struct wl_touch_listener wl_touch_listener = {       
@@ -430,7 +633,10 @@ static const struct wl_touch_listener wl_touch_listener = {
 static void
 wl_seat_name(void *data, struct wl_seat *wl_seat, const char *name)
 {
-       fprintf(stderr, "seat name: %s\n", name);
+       TRACE_FUNC();
+       union evlog_arg arg = { 0 };
+       memcpy(arg.s, name, strnlen(name, sizeof(arg.s)));
+       evlog_raw(EVLOG_DEBUG, EVLOG_SEAT_NAME, 0, &arg);
 }
 
 // static void wl_surface_enter(void *data,
@@ -454,23 +660,43 @@ static void
 wl_keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
                uint32_t format, int32_t fd, uint32_t size)
 {
+       TRACE_FUNC();
        struct client_state *client_state = data;
        assert(format == WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1);
 
-       char *map_shm = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
-       assert(map_shm != MAP_FAILED);
-
-       struct xkb_keymap *xkb_keymap = xkb_keymap_new_from_string(
-                       client_state->xkb_context, map_shm,
-                       XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
-       munmap(map_shm, size);
+       struct xkb_keymap *xkb_keymap = keymap_cache_get_fd(
+                       &client_state->keymap_cache, fd, size);
        close(fd);
+       assert(xkb_keymap != NULL);
+
+       /* Same keymap resent: keep the state and the keysym cache warm */
+       if (xkb_keymap == client_state->xkb_keymap) {
+               xkb_keymap_unref(xkb_keymap);
+               return;
+       }
 
        struct xkb_state *xkb_state = xkb_state_new(xkb_keymap);
        xkb_keymap_unref(client_state->xkb_keymap);
        xkb_state_unref(client_state->xkb_state);
        client_state->xkb_keymap = xkb_keymap;
        client_state->xkb_state = xkb_state;
+       keysym_cache_set_state(&client_state->keysym_cache, xkb_state);
+}
+
+static void
+log_key(struct client_state *client_state, uint32_t key, uint32_t time,
+               enum evlog_type type)
+{
+       if (!EVLOG_ENABLED(EVLOG_INFO)) {
+               return;
+       }
+       /* Hot path: an array lookup unless the modifiers just changed */
+       const struct keysym_entry *entry = keysym_cache_lookup(
+                       &client_state->keysym_cache, key + 8);
+       union evlog_arg arg = { .key = { key, entry->sym } };
+       memcpy(arg.key.utf8, entry->utf8,
+                       strnlen(entry->utf8, sizeof(arg.key.utf8)));
+       evlog_raw(EVLOG_INFO, type, time, &arg);
 }
 
 static void
@@ -478,43 +704,50 @@ wl_keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
                uint32_t serial, struct wl_surface *surface,
                struct wl_array *keys)
 {
+       TRACE_FUNC();
        struct client_state *client_state = data;
-       fprintf(stderr, "keyboard enter; keys pressed are:\n");
+       evlog(EVLOG_INFO, EVLOG_KEYBOARD_ENTER, 0, 0);
        uint32_t *key;
        wl_array_for_each(key, keys) {
-               char buf[128];
-               xkb_keysym_t sym = xkb_state_key_get_one_sym(
-                               client_state->xkb_state, *key + 8);
-               xkb_keysym_get_name(sym, buf, sizeof(buf));
-               fprintf(stderr, "sym: %-12s (%d), ", buf, sym);
-               xkb_state_key_get_utf8(client_state->xkb_state,
-                               *key + 8, buf, sizeof(buf));
-               fprintf(stderr, "utf8: '%s'\n", buf);
+               log_key(client_state, *key, 0, EVLOG_KEYBOARD_ENTER_KEY);
        }
 }
 
+
+static void
+key_repeat(void *data, uint32_t key)
+{
+       TRACE_FUNC();
+       struct client_state *client_state = data;
+       log_key(client_state, key, 0, EVLOG_KEY_REPEAT);
+}
+
 static void
 wl_keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
                uint32_t serial, uint32_t time, uint32_t key, uint32_t state)
 {
+       TRACE_FUNC();
        struct client_state *client_state = data;
-       char buf[128];
-       uint32_t keycode = key + 8;
-       xkb_keysym_t sym = xkb_state_key_get_one_sym(
-                       client_state->xkb_state, keycode);
-       xkb_keysym_get_name(sym, buf, sizeof(buf));
-       const char *action =
-              state == WL_KEYBOARD_KEY_STATE_PRESSED ? "press" : "release";
-       fprintf(stderr, "key %s: sym: %-12s (%d), ", action, buf, sym);
-       xkb_state_key_get_utf8(client_state->xkb_state, keycode,
-                       buf, sizeof(buf));       fprintf(stderr, "utf8: '%s'\n", buf);
+       metrics_count(&client_state->metrics, METRICS_KEYS);
+       input_latency_mark(&client_state->input_latency, INPUT_LATENCY_KEY);
+       log_key(client_state, key, time, state == WL_KEYBOARD_KEY_STATE_PRESSED ?
+                       EVLOG_KEY_PRESS : EVLOG_KEY_RELEASE);
+
+       if (state == WL_KEYBOARD_KEY_STATE_RELEASED) {
+               key_repeat_release(&client_state->key_repeat, key);
+       } else if (xkb_keymap_key_repeats(client_state->xkb_keymap, key + 8)) {
+               key_repeat_press(&client_state->key_repeat, key);
+       }
 }
 
 static void
 wl_keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
                uint32_t serial, struct wl_surface *surface)
 {
-       fprintf(stderr, "keyboard leave\n");
+       TRACE_FUNC();
+       struct client_state *client_state = data;
+       evlog(EVLOG_INFO, EVLOG_KEYBOARD_LEAVE, 0, 0);
+       key_repeat_cancel(&client_state->key_repeat);
 }
 
 static void
@@ -523,16 +756,20 @@ wl_keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
                uint32_t mods_latched, uint32_t mods_locked,
                uint32_t group)
 {
+       TRACE_FUNC();
        struct client_state *client_state = data;
        xkb_state_update_mask(client_state->xkb_state,
                mods_depressed, mods_latched, mods_locked, 0, 0, group);
+       keysym_cache_update(&client_state->keysym_cache);
 }
 
 static void
 wl_keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
                int32_t rate, int32_t delay)
 {
-       /* Left as an exercise for the reader */
+       TRACE_FUNC();
+       struct client_state *client_state = data;
+       key_repeat_set_info(&client_state->key_repeat, rate, delay);
 }
 
 static const struct wl_keyboard_listener wl_keyboard_listener = {       
@@ -548,72 +785,11 @@ static const struct wl_keyboard_listener wl_keyboard_listener = {
 static void
 wl_pointer_frame(void *data, struct wl_pointer *wl_pointer)
 {
-        printf("wl_pointer_frame\n");
-
+       TRACE_FUNC();
        struct client_state *client_state = data;
+       metrics_count(&client_state->metrics, METRICS_POINTER_FRAMES);
        struct pointer_event *event = &client_state->pointer_event;
-       fprintf(stderr, "pointer frame @ %d: ", event->time);
-
-       if (event->event_mask & POINTER_EVENT_ENTER) {
-               fprintf(stderr, "entered %f, %f ",
-                               wl_fixed_to_double(event->surface_x),
-                               wl_fixed_to_double(event->surface_y));
-       }
-
-       if (event->event_mask & POINTER_EVENT_LEAVE) {
-               fprintf(stderr, "leave");
-       }
-
-       if (event->event_mask & POINTER_EVENT_MOTION) {
-               fprintf(stderr, "motion %f, %f ",
-                               wl_fixed_to_double(event->surface_x),
-                               wl_fixed_to_double(event->surface_y));
-       }
-
-       if (event->event_mask & POINTER_EVENT_BUTTON) {
-               char *state = event->state == WL_POINTER_BUTTON_STATE_RELEASED ?
-                       "released" : "pressed";
-               fprintf(stderr, "button %d %s ", event->button, state);
-       }
-
-       uint32_t axis_events = POINTER_EVENT_AXIS
-               | POINTER_EVENT_AXIS_SOURCE
-               | POINTER_EVENT_AXIS_STOP
-               | POINTER_EVENT_AXIS_DISCRETE;
-       char *axis_name[2] = {
-               [WL_POINTER_AXIS_VERTICAL_SCROLL] = "vertical",
-               [WL_POINTER_AXIS_HORIZONTAL_SCROLL] = "horizontal",
-       };
-       char *axis_source[4] = {
-               [WL_POINTER_AXIS_SOURCE_WHEEL] = "wheel",
-               [WL_POINTER_AXIS_SOURCE_FINGER] = "finger",
-               [WL_POINTER_AXIS_SOURCE_CONTINUOUS] = "continuous",
-               [WL_POINTER_AXIS_SOURCE_WHEEL_TILT] = "wheel tilt",
-       };
-       if (event->event_mask & axis_events) {               for (size_t i = 0; i < 2; ++i) {
-                       if (!event->axes[i].valid) {
-                              continue;
-                      }
-                       fprintf(stderr, "%s axis ", axis_name[i]);
-                      if (event->event_mask & POINTER_EVENT_AXIS) {
-                               fprintf(stderr, "value %f ", wl_fixed_to_double(
-                                                       event->axes[i].value));
-                       }
-                       if (event->event_mask & POINTER_EVENT_AXIS_DISCRETE) {
-                               fprintf(stderr, "discrete %d ",
-                                               event->axes[i].discrete);
-                       }
-                       if (event->event_mask & POINTER_EVENT_AXIS_SOURCE) {
-                               fprintf(stderr, "via %s ",
-                                               axis_source[event->axis_source]);
-                       }
-                       if (event->event_mask & POINTER_EVENT_AXIS_STOP) {
-                               fprintf(stderr, "(stopped) ");
-                       }
-               }
-       }
-
-       fprintf(stderr, "\n");
+       evlog(EVLOG_INFO, EVLOG_POINTER_FRAME, event->time, 0);
        memset(event, 0, sizeof(*event));
 }
 
@@ -622,9 +798,12 @@ static void
 wl_pointer_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
                uint32_t axis, wl_fixed_t value)
 {
-        printf("wl_pointer_axis\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_POINTER_AXIS, time, axis, value);
 
        struct client_state *client_state = data;
+       metrics_count(&client_state->metrics, METRICS_POINTER_AXES);
+       input_latency_mark(&client_state->input_latency, INPUT_LATENCY_AXIS);
        client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS;
        client_state->pointer_event.time = time;
        client_state->pointer_event.axes[axis].valid = true;
@@ -635,7 +814,9 @@ static void
 wl_pointer_axis_source(void *data, struct wl_pointer *wl_pointer,
                uint32_t axis_source)
 {
+       TRACE_FUNC();
        struct client_state *client_state = data;
+       evlog(EVLOG_INFO, EVLOG_POINTER_AXIS_SOURCE, 0, axis_source);
        client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_SOURCE;
        client_state->pointer_event.axis_source = axis_source;
 }
@@ -644,7 +825,9 @@ static void
 wl_pointer_axis_stop(void *data, struct wl_pointer *wl_pointer,
                uint32_t time, uint32_t axis)
 {
+       TRACE_FUNC();
        struct client_state *client_state = data;
+       evlog(EVLOG_INFO, EVLOG_POINTER_AXIS_STOP, time, axis);
        client_state->pointer_event.time = time;
        client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_STOP;
        client_state->pointer_event.axes[axis].valid = true;
@@ -654,7 +837,9 @@ static void
 wl_pointer_axis_discrete(void *data, struct wl_pointer *wl_pointer,
                uint32_t axis, int32_t discrete)
 {
+       TRACE_FUNC();
        struct client_state *client_state = data;
+       evlog(EVLOG_INFO, EVLOG_POINTER_AXIS_DISCRETE, 0, axis, discrete);
        client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_DISCRETE;
        client_state->pointer_event.axes[axis].valid = true;
        client_state->pointer_event.axes[axis].discrete = discrete;
@@ -665,31 +850,39 @@ static void
 wl_pointer_motion(void *data, struct wl_pointer *wl_pointer, uint32_t time,
                wl_fixed_t surface_x, wl_fixed_t surface_y)
 {
-        printf("wl_pointer_motion\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_POINTER_MOTION, time, surface_x, surface_y);
 
        struct client_state *client_state = data;
+       metrics_count(&client_state->metrics, METRICS_POINTER_MOTIONS);
+       input_latency_mark(&client_state->input_latency, INPUT_LATENCY_MOTION);
        client_state->pointer_event.event_mask |= POINTER_EVENT_MOTION;
        client_state->pointer_event.time = time;
-       client_state->pointer_event.surface_x = surface_x,
-               client_state->pointer_event.surface_y = surface_y;
+       motion_history_push(&client_state->motion_history,
+                       surface_x, surface_y, time, 0);
 }
 
 static void
 wl_pointer_button(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
                uint32_t time, uint32_t button, uint32_t state)
 {
-        printf("wl_pointer_button\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_POINTER_BUTTON, time, serial, button, state);
 
        struct client_state *client_state = data;
+       metrics_count(&client_state->metrics, METRICS_POINTER_BUTTONS);
+       input_latency_mark(&client_state->input_latency, INPUT_LATENCY_BUTTON);
        client_state->pointer_event.event_mask |= POINTER_EVENT_BUTTON;
        client_state->pointer_event.time = time;
        client_state->pointer_event.serial = serial;
        client_state->pointer_event.button = button,
                client_state->pointer_event.state = state;
 
-    if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED) {
+    /* No toplevel when replaying a trace */
+    if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED
+            && client_state->xdg_toplevel != NULL) {
         xdg_toplevel_move(client_state->xdg_toplevel, client_state->wl_seat, serial);
-        printf("xdg_toplevel_move\n");
+        evlog(EVLOG_INFO, EVLOG_TOPLEVEL_MOVE, time, serial);
     }
 }
 
@@ -700,20 +893,22 @@ wl_pointer_enter(void *data, struct wl_pointer *wl_pointer,
                uint32_t serial, struct wl_surface *surface,
                wl_fixed_t surface_x, wl_fixed_t surface_y)
 {
-        printf("wl_pointer_enter\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_POINTER_ENTER, 0, serial, surface_x, surface_y);
 
        struct client_state *client_state = data;
       client_state->pointer_event.event_mask |= POINTER_EVENT_ENTER;
        client_state->pointer_event.serial = serial;
-       client_state->pointer_event.surface_x = surface_x,
-               client_state->pointer_event.surface_y = surface_y;
+       motion_history_push(&client_state->motion_history,
+                       surface_x, surface_y, 0, MOTION_SAMPLE_ENTER);
 }
 
 static void
 wl_pointer_leave(void *data, struct wl_pointer *wl_pointer,
                uint32_t serial, struct wl_surface *surface)
 {
-        printf("wl_pointer_leave\n");
+       TRACE_FUNC();
+       evlog(EVLOG_INFO, EVLOG_POINTER_LEAVE, 0, serial);
 
        struct client_state *client_state = data;
        client_state->pointer_event.serial = serial;
@@ -735,15 +930,23 @@ static const struct wl_pointer_listener wl_pointer_listener = {
 static void
 wl_seat_capabilities(void *data, struct wl_seat *wl_seat, uint32_t capabilities)
 {
-        printf("seat cap: %u\n", capabilities);
+       TRACE_FUNC();
+       evlog(EVLOG_DEBUG, EVLOG_SEAT_CAPABILITIES, 0, capabilities);
        struct client_state *state = data;
 
        bool have_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
 
        if (have_pointer && state->wl_pointer == NULL) {
                state->wl_pointer = wl_seat_get_pointer(state->wl_seat);
-               wl_pointer_add_listener(state->wl_pointer, &wl_pointer_listener, state);
+               if (state->input_trace != NULL) {
+                       input_trace_add_pointer(state->input_trace, state->wl_pointer);
+               } else {
+                       wl_pointer_add_listener(state->wl_pointer, &wl_pointer_listener, state);
+               }
+               input_latency_start(&state->input_latency,
+                               INPUT_LATENCY_POINTER, state->wl_pointer);
       } else if (!have_pointer && state->wl_pointer != NULL) {
+               input_latency_stop(&state->input_latency, INPUT_LATENCY_POINTER);
                wl_pointer_release(state->wl_pointer);
                state->wl_pointer = NULL;
        }
@@ -753,9 +956,18 @@ wl_seat_capabilities(void *data, struct wl_seat *wl_seat, uint32_t capabilities)
 
        if (have_keyboard && state->wl_keyboard == NULL) {
                state->wl_keyboard = wl_seat_get_keyboard(state->wl_seat);
-               wl_keyboard_add_listener(state->wl_keyboard,
-                               &wl_keyboard_listener, state);
+               if (state->input_trace != NULL) {
+                       input_trace_add_keyboard(state->input_trace,
+                                       state->wl_keyboard);
+               } else {
+                       wl_keyboard_add_listener(state->wl_keyboard,
+                                       &wl_keyboard_listener, state);
+               }
+               input_latency_start(&state->input_latency,
+                               INPUT_LATENCY_KEYBOARD, state->wl_keyboard);
        } else if (!have_keyboard && state->wl_keyboard != NULL) {
+               key_repeat_cancel(&state->key_repeat);
+               input_latency_stop(&state->input_latency, INPUT_LATENCY_KEYBOARD);
                wl_keyboard_release(state->wl_keyboard);
                state->wl_keyboard = NULL;
        }
@@ -764,8 +976,16 @@ wl_seat_capabilities(void *data, struct wl_seat *wl_seat, uint32_t capabilities)
 
        if (have_touch && state->wl_touch == NULL) {
                 state->wl_touch = wl_seat_get_touch(state->wl_seat);
-                wl_touch_add_listener(state->wl_touch, &wl_touch_listener, state);       
+                if (state->input_trace != NULL) {
+                        input_trace_add_touch(state->input_trace, state->wl_touch);
+                } else {
+                        wl_touch_add_listener(state->wl_touch, &wl_touch_listener, state);
+                }
+                input_latency_start(&state->input_latency,
+                                INPUT_LATENCY_TOUCHSCREEN, state->wl_touch);
         } else if (!have_touch && state->wl_touch != NULL) {
+                input_latency_stop(&state->input_latency,
+                                INPUT_LATENCY_TOUCHSCREEN);
                 wl_touch_release(state->wl_touch);
                 state->wl_touch = NULL;
         }
@@ -778,29 +998,141 @@ static const struct wl_seat_listener wl_seat_listener = {
 
 static const struct wl_callback_listener wl_surface_frame_listener;
 
+/*
+ * Whether the next frame is painted ahead on the render thread. Pacing
+ * needs the frame planned when it starts, or it would only hold back a
+ * frame whose content is already an interval old.
+ */
+static bool
+paint_ahead(const struct client_state *state)
+{
+	return state->render_thread != NULL
+		&& state->frame_pacing.margin_ns == 0;
+}
+
+/* Render, attach and commit one frame; begin is when we started on it */
+static void
+submit_frame(struct client_state *state, uint64_t begin)
+{
+	TRACE_FUNC();
+	/* Submit a frame for this event */
+	/* Nothing to attach when the frame is unchanged or no buffer is free */
+	struct frame_job *job;
+	if (paint_ahead(state)) {
+		/* Painted during the last frame interval, if it made it in time */
+		job = render_thread_take(state->render_thread);
+	} else {
+		job = draw_frame(state);
+	}
+	uint64_t lap = frame_stats_lap(&state->frame_stats,
+			FRAME_STAGE_RENDER, begin);
+	TRACE_COMPLETE("render", begin, lap);
+	uint64_t start = lap;
+	if (job != NULL && job->wl_buffer != NULL) {
+		wl_surface_attach(state->wl_surface, job->wl_buffer, 0, 0);
+		if (job->cached != NULL) {
+			job->cached->busy = true;
+		}
+		damage_emit(&job->damage, state->wl_surface);
+	}
+	frame_pacing_commit(&state->frame_pacing, state->wl_surface);
+	lap = frame_stats_lap(&state->frame_stats, FRAME_STAGE_ATTACH, lap);
+	TRACE_COMPLETE("attach", start, lap);
+	start = lap;
+	wl_surface_commit(state->wl_surface);
+	lap = frame_stats_lap(&state->frame_stats, FRAME_STAGE_COMMIT, lap);
+	TRACE_COMPLETE("commit", start, lap);
+	if (job != NULL) {
+		input_latency_commit(&state->input_latency, &job->input, lap);
+	}
+	frame_pacing_rendered(&state->frame_pacing, lap - begin);
+	/*
+	 * Send it now rather than after whatever else is queued; if the
+	 * socket is full the event loop sends the rest once it drains.
+	 */
+	wl_display_flush(state->wl_display);
+	start = lap;
+	lap = frame_stats_lap(&state->frame_stats, FRAME_STAGE_FLUSH, lap);
+	TRACE_COMPLETE("flush", start, lap);
+	frame_stats_end(&state->frame_stats, begin);
+
+	/* Start on the next frame, at where the scroll will be by then */
+	if (paint_ahead(state)
+			&& !render_thread_pending(state->render_thread)) {
+		job = &state->frame_job;
+		plan_frame(state, state->offset + state->frame_elapsed / 1000.0 * 24,
+				predict_present(state, 1), job);
+		render_thread_submit(state->render_thread, job);
+	}
+}
+
+static void
+pacing_timer_fired(void *data, uint64_t expirations)
+{
+	TRACE_FUNC();
+	struct client_state *state = data;
+	submit_frame(state, frame_stats_now());
+}
+
+/* Per frame callback: count it, and sample what only changes per frame */
+static void
+publish_frame_metrics(struct client_state *state)
+{
+	struct metrics *metrics = &state->metrics;
+	if (metrics->page == NULL) {
+		return;
+	}
+	const struct buffer_pool *pool = &state->buffer_pool;
+	int busy = 0;
+	for (int i = 0; i < pool->nslots; ++i) {
+		busy += pool->slots[i].busy;
+	}
+
+	metrics_begin(metrics);
+	metrics_add(metrics, METRICS_FRAMES, 1);
+	metrics_set(metrics, METRICS_LATE_FRAMES, atomic_load_explicit(
+				&state->frame_stats.late_frames, memory_order_relaxed));
+	metrics_set(metrics, METRICS_MISSED_REFRESHES, atomic_load_explicit(
+				&state->frame_stats.missed_frames, memory_order_relaxed));
+	metrics_set(metrics, METRICS_SKIPPED_REFRESHES,
+			state->frame_pacing.skipped);
+	metrics_set(metrics, METRICS_SHM_BYTES, pool->size
+			+ state->phase_cache.pool.size + state->viewport_pool.size);
+	metrics_set(metrics, METRICS_POOL_BUFFERS, pool->nslots);
+	metrics_set(metrics, METRICS_POOL_BUSY, busy);
+	metrics_end(metrics);
+}
+
 static void
 wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time)
 {
+	TRACE_FUNC();
+	struct client_state *state = data;
+	uint64_t begin = frame_stats_begin(&state->frame_stats);
+
 	/* Destroy this callback */
 	wl_callback_destroy(cb);
 
 	/* Request another frame */
-	struct client_state *state = data;
 	cb = wl_surface_frame(state->wl_surface);
 	wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
 	/* Update scroll amount at 24 pixels per second */
+	int elapsed = 0;
 	if (state->last_frame != 0) {
-		int elapsed = time - state->last_frame;
+		elapsed = time - state->last_frame;
 		state->offset += elapsed / 1000.0 * 24;
 	}
-
-	/* Submit a frame for this event */
-	struct wl_buffer *buffer = draw_frame(state);
-	wl_surface_attach(state->wl_surface, buffer, 0, 0);
-	wl_surface_damage_buffer(state->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
-	wl_surface_commit(state->wl_surface);
-
+	state->frame_elapsed = elapsed;
 	state->last_frame = time;
+	publish_frame_metrics(state);
+
+	/* Start as late as still makes the next refresh, to show fresher input */
+	uint64_t delay = frame_pacing_delay(&state->frame_pacing);
+	if (delay > 0 && state->pacing_timer != NULL) {
+		event_source_timer_update(state->pacing_timer, delay, 0);
+		return;
+	}
+	submit_frame(state, begin);
 }
 
 static const struct wl_callback_listener wl_surface_frame_listener = {
@@ -812,6 +1144,7 @@ static void
 registry_global(void *data, struct wl_registry *wl_registry,
         uint32_t name, const char *interface, uint32_t version)
 {
+    TRACE_FUNC();
 printf("registry_global\n");
 
     struct client_state *state = data;
@@ -831,6 +1164,17 @@ printf("registry_global\n");
                                wl_registry, name, &wl_seat_interface, 7);
                wl_seat_add_listener(state->wl_seat,
                                &wl_seat_listener, state);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        state->wp_viewporter = wl_registry_bind(
+                wl_registry, name, &wp_viewporter_interface, 1);
+    } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        frame_pacing_set_presentation(&state->frame_pacing, wl_registry_bind(
+                wl_registry, name, &wp_presentation_interface, 1));
+    } else if (strcmp(interface,
+                zwp_input_timestamps_manager_v1_interface.name) == 0) {
+        input_latency_set_manager(&state->input_latency, wl_registry_bind(
+                wl_registry, name,
+                &zwp_input_timestamps_manager_v1_interface, 1));
     }
 }
 
@@ -838,6 +1182,7 @@ static void
 registry_global_remove(void *data,
         struct wl_registry *wl_registry, uint32_t name)
 {
+    TRACE_FUNC();
     printf("registry_global_remove\n");
 }
 
@@ -846,6 +1191,227 @@ static const struct wl_registry_listener wl_registry_listener = {
     .global_remove = registry_global_remove,
 };
 
+/*
+ * WL_RENDER_THREADS sets the number of render workers (default: one per
+ * CPU besides this one), WL_RENDER_CPUS a comma separated list of CPUs to
+ * pin them to.
+ */
+static struct thread_pool *
+create_render_pool(void)
+{
+    long nworkers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    const char *env = getenv("WL_RENDER_THREADS");
+    if (env != NULL) {
+        nworkers = strtol(env, NULL, 10);
+    }
+
+    int cpus[THREAD_POOL_MAX_WORKERS];
+    int ncpus = 0;
+    env = getenv("WL_RENDER_CPUS");
+    while (env != NULL && *env != '\0' && ncpus < THREAD_POOL_MAX_WORKERS) {
+        char *end;
+        long cpu = strtol(env, &end, 10);
+        if (end == env) {
+            break;
+        }
+        cpus[ncpus++] = cpu;
+        env = *end == ',' ? end + 1 : end;
+    }
+
+    return thread_pool_create(nworkers, cpus, ncpus);
+}
+
+static void
+report_motion_history(const struct client_state *state)
+{
+    fprintf(stderr, "pointer motion: %llu samples, %llu dropped before a "
+            "frame took them\n",
+            (unsigned long long)state->motion_history.head,
+            (unsigned long long)state->motion_history.dropped);
+}
+
+static void
+report_touch(const struct client_state *state)
+{
+    const struct touch_table *points = &state->touch_event.points;
+    fprintf(stderr, "touch: %u of %u contacts at most, %llu dropped\n",
+            points->peak, points->capacity,
+            (unsigned long long)points->dropped);
+    fprintf(stderr, "gesture recognition per touch frame, ns:\n");
+    fprintf(stderr, FRAME_HISTOGRAM_HEADER, "stage");
+    frame_histogram_report_scaled(&state->gesture_cost, "gesture", 1,
+            stderr);
+}
+
+static void
+export_trace(struct client_state *state)
+{
+    if (state->trace_path == NULL) {
+        return;
+    }
+    if (trace_export(state->trace_path,
+                trace_format_for_path(state->trace_path)) < 0) {
+        perror(state->trace_path);
+        return;
+    }
+    fprintf(stderr, "trace written to %s\n", state->trace_path);
+}
+
+static void
+handle_signals(void *data, uint64_t events)
+{
+    struct client_state *state = data;
+    struct signalfd_siginfo info;
+    bool report = false, export = false;
+    while (read(state->stats_signal_fd, &info, sizeof(info))
+            == sizeof(info)) {
+        if (info.ssi_signo == SIGUSR2) {
+            export = true;
+        } else {
+            report = true;
+        }
+    }
+    if (report) {
+        frame_stats_report(&state->frame_stats, stderr);
+        frame_pacing_report(&state->frame_pacing, stderr);
+        input_latency_report(&state->input_latency, stderr);
+        report_motion_history(state);
+        pointer_predict_report(&state->pointer_predict, stderr);
+        report_touch(state);
+    }
+    if (export) {
+        export_trace(state);
+    }
+}
+
+/*
+ * WL_TRACE turns on tracing and names the file SIGUSR2 and exiting write
+ * it to: Perfetto protobuf if it ends in .pftrace, Chrome JSON otherwise.
+ */
+static void
+init_trace(struct client_state *state)
+{
+    state->trace_path = getenv("WL_TRACE");
+    if (state->trace_path == NULL) {
+        return;
+    }
+    if (!TRACE_ENABLED) {
+        fprintf(stderr, "WL_TRACE: built with TRACE_ENABLED=0\n");
+        state->trace_path = NULL;
+        return;
+    }
+    trace_start();
+}
+
+/*
+ * WL_FRAME_DEADLINE_US is the frame budget (default: 60 Hz) late frames
+ * are counted against. The stats are printed on SIGUSR1, and on exit if
+ * WL_FRAME_STATS is set.
+ *
+ * WL_PACING_MARGIN_US turns on just-in-time rendering: each frame starts
+ * as late as it can and still be committed this long before the refresh
+ * wp_presentation predicts. Frames are then planned and painted when they
+ * start, not ahead on the render thread.
+ *
+ * WL_PREDICT_HORIZON_US turns on pointer prediction, extrapolating at most
+ * this far past the newest motion sample.
+ */
+static void
+init_frame_stats(struct client_state *state)
+{
+    uint64_t deadline_us = 16667;
+    const char *env = getenv("WL_FRAME_DEADLINE_US");
+    if (env != NULL) {
+        deadline_us = strtoull(env, NULL, 10);
+    }
+    frame_stats_init(&state->frame_stats, deadline_us * 1000);
+    input_latency_init(&state->input_latency);
+
+    uint64_t margin_us = 0;
+    env = getenv("WL_PACING_MARGIN_US");
+    if (env != NULL) {
+        margin_us = strtoull(env, NULL, 10);
+    }
+    frame_pacing_init(&state->frame_pacing, &state->frame_stats,
+            margin_us * 1000);
+
+    uint64_t horizon_us = 0;
+    env = getenv("WL_PREDICT_HORIZON_US");
+    if (env != NULL) {
+        horizon_us = strtoull(env, NULL, 10);
+    }
+    pointer_predict_init(&state->pointer_predict, horizon_us * 1000);
+    if (margin_us > 0) {
+        state->pacing_timer = event_loop_add_timer(state->event_loop,
+                pacing_timer_fired, state);
+    }
+
+    /* Blocked before any thread starts, so only the signalfd sees it */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    state->stats_signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (state->stats_signal_fd >= 0) {
+        state->stats_signal = event_loop_add_fd(state->event_loop,
+                state->stats_signal_fd, EPOLLIN, handle_signals, state);
+    }
+}
+
+/*
+ * WL_TOUCH_CAPACITY sets how many touch contacts are tracked at once;
+ * contacts beyond it are ignored until one lifts.
+ */
+static void
+init_touch(struct client_state *state)
+{
+    long capacity = TOUCH_TABLE_DEFAULT_CAPACITY;
+    const char *env = getenv("WL_TOUCH_CAPACITY");
+    if (env != NULL) {
+        capacity = strtol(env, NULL, 10);
+    }
+    if (capacity <= 0 || capacity > INT32_MAX / 2) {
+        capacity = TOUCH_TABLE_DEFAULT_CAPACITY;
+    }
+    if (touch_table_init(&state->touch_event.points, capacity) < 0) {
+        perror("touch_table_init");
+    }
+    gesture_init(&state->gesture, handle_gesture, state);
+}
+
+/*
+ * Feeds a trace recorded with WL_INPUT_RECORD through the input handlers
+ * without a compositor, as fast as possible unless WL_INPUT_REPLAY_REALTIME
+ * is set, and reports how long the handlers took.
+ */
+static int
+replay_input(struct client_state *state, const char *path)
+{
+    const struct input_listeners listeners = {
+        .pointer = &wl_pointer_listener,
+        .keyboard = &wl_keyboard_listener,
+        .touch = &wl_touch_listener,
+        .data = state,
+    };
+    bool realtime = getenv("WL_INPUT_REPLAY_REALTIME") != NULL;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long count = input_trace_replay(path, &listeners, realtime);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (count < 0) {
+        fprintf(stderr, "%s: not an input trace\n", path);
+        return 1;
+    }
+
+    double elapsed = (end.tv_sec - start.tv_sec) * 1e9
+        + (end.tv_nsec - start.tv_nsec);
+    fprintf(stderr, "replayed %ld events in %.3f ms, %.0f ns/event\n",
+            count, elapsed / 1e6, count > 0 ? elapsed / count : 0);
+    return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -853,17 +1419,82 @@ main(int argc, char *argv[])
 
     state.width = 640;
     state.height = 480;
+    state.drawn_offset = -1;
     
+    state.event_loop = event_loop_create();
+    init_trace(&state);
+    init_frame_stats(&state);
+    keysym_cache_init(&state.keysym_cache);
+    motion_history_init(&state.motion_history);
+    init_touch(&state);
+    key_repeat_init(&state.key_repeat, state.event_loop, key_repeat, &state);
+    state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    keymap_cache_init(&state.keymap_cache, state.xkb_context);
+
+    const char *replay = getenv("WL_INPUT_REPLAY");
+    if (replay != NULL) {
+        int ret = replay_input(&state, replay);
+        export_trace(&state);
+        key_repeat_finish(&state.key_repeat);
+        xkb_state_unref(state.xkb_state);
+        xkb_keymap_unref(state.xkb_keymap);
+        keysym_cache_finish(&state.keysym_cache);
+        keymap_cache_finish(&state.keymap_cache);
+        touch_table_finish(&state.touch_event.points);
+        evlog_thread_finish();
+        event_source_remove(state.pacing_timer);
+        event_source_remove(state.stats_signal);
+        if (state.stats_signal_fd >= 0) {
+            close(state.stats_signal_fd);
+        }
+        event_loop_destroy(state.event_loop);
+        trace_finish();
+        return ret;
+    }
+
+    const char *record = getenv("WL_INPUT_RECORD");
+    if (record != NULL) {
+        const struct input_listeners listeners = {
+            .pointer = &wl_pointer_listener,
+            .keyboard = &wl_keyboard_listener,
+            .touch = &wl_touch_listener,
+            .data = &state,
+        };
+        state.input_trace = input_trace_create(record, &listeners);
+        if (state.input_trace == NULL) {
+            perror(record);
+        }
+    }
+
+    /* WL_METRICS publishes live metrics in /dev/shm for metrics_read */
+    if (getenv("WL_METRICS") != NULL && metrics_open(&state.metrics) < 0) {
+        perror("WL_METRICS");
+    }
+
     state.wl_display = wl_display_connect(NULL);
     state.wl_registry = wl_display_get_registry(state.wl_display);
-    state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 
     wl_registry_add_listener(state.wl_registry, &wl_registry_listener, &state);
     
     wl_display_roundtrip(state.wl_display); 
     // Block until all pending request are processed by the server. 
 
+    /* Triple buffering: one on screen, one queued, one being drawn */
+    int shm_flags = getenv("WL_SHM_HUGEPAGES") ? SHM_HUGEPAGES : 0;
+    buffer_pool_init(&state.buffer_pool, state.wl_shm, 3, shm_flags);
+    phase_cache_init(&state.phase_cache, state.wl_shm, shm_flags);
+    buffer_pool_init(&state.viewport_pool, state.wl_shm, 1, shm_flags);
+    state.buffer_pool.metrics = &state.metrics;
+    state.phase_cache.pool.metrics = &state.metrics;
+    state.viewport_pool.metrics = &state.metrics;
+    state.render_pool = create_render_pool();
+    state.render_thread = render_thread_create(paint_frame);
+
     state.wl_surface = wl_compositor_create_surface(state.wl_compositor);
+    if (state.wp_viewporter != NULL) {
+        state.wp_viewport = wp_viewporter_get_viewport(
+                state.wp_viewporter, state.wl_surface);
+    }
 
     state.xdg_surface = xdg_wm_base_get_xdg_surface(state.xdg_wm_base, state.wl_surface);
 
@@ -879,10 +1510,43 @@ main(int argc, char *argv[])
 	struct wl_callback *cb = wl_surface_frame(state.wl_surface);
 	wl_callback_add_listener(cb, &wl_surface_frame_listener, &state);
 
-    while (wl_display_dispatch(state.wl_display)) {
-        /* This space deliberately left blank */
+    while (!state.closed) {
+        if (event_loop_dispatch(state.event_loop, state.wl_display, -1) < 0) {
+            break;
+        }
     }
 
+    if (getenv("WL_FRAME_STATS") != NULL) {
+        frame_stats_report(&state.frame_stats, stderr);
+        frame_pacing_report(&state.frame_pacing, stderr);
+        input_latency_report(&state.input_latency, stderr);
+        report_motion_history(&state);
+        pointer_predict_report(&state.pointer_predict, stderr);
+        report_touch(&state);
+    }
+    export_trace(&state);
+    frame_pacing_finish(&state.frame_pacing);
+    input_latency_finish(&state.input_latency);
+    event_source_remove(state.pacing_timer);
+
+    key_repeat_finish(&state.key_repeat);
+    keysym_cache_finish(&state.keysym_cache);
+    keymap_cache_finish(&state.keymap_cache);
+    touch_table_finish(&state.touch_event.points);
+    input_trace_destroy(state.input_trace);
+    event_source_remove(state.stats_signal);
+    if (state.stats_signal_fd >= 0) {
+        close(state.stats_signal_fd);
+    }
+    evlog_thread_finish();
+    event_loop_destroy(state.event_loop);
+    render_thread_destroy(state.render_thread);
+    thread_pool_destroy(state.render_pool);
+    buffer_pool_finish(&state.viewport_pool);
+    phase_cache_finish(&state.phase_cache);
+    buffer_pool_finish(&state.buffer_pool);
+    metrics_close(&state.metrics);
+    trace_finish();
     return 0;
 }
 